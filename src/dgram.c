@@ -0,0 +1,391 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+
+#include <verto.h>
+
+/* Defaults for verto_dgram_new() */
+#define DGRAM_BATCH 32
+#define DGRAM_MAXSIZE 2048
+
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+#define DGRAM_MMSG
+#endif
+
+typedef struct dgram_out dgram_out;
+struct dgram_out {
+    dgram_out *next;
+    size_t len;
+    socklen_t addrlen;
+    struct sockaddr_storage addr;
+    char data[1];
+};
+
+struct verto_dgram {
+    verto_ev *ev;
+    verto_dgram_callback *callback;
+    void *priv;
+    size_t batch;      /* Datagrams per recvmmsg()/sendmmsg() */
+    size_t maxsize;    /* Size of each slot of the ring */
+    char *ring;        /* batch slots of maxsize bytes */
+    struct sockaddr_storage *addrs;
+    verto_datagram *msgs;
+    struct iovec *iov;
+#ifdef DGRAM_MMSG
+    struct mmsghdr *hdrs;
+#endif
+    dgram_out *head;   /* Output queue */
+    dgram_out *tail;
+    size_t pending;
+    int freed;
+};
+
+static void
+set_write_interest(verto_dgram *dgram, int on)
+{
+    verto_ev_flag flags = verto_get_flags(dgram->ev);
+
+    if (on)
+        verto_set_flags(dgram->ev, flags | VERTO_EV_FLAG_IO_WRITE);
+    else
+        verto_set_flags(dgram->ev, flags & ~VERTO_EV_FLAG_IO_WRITE);
+}
+
+static void
+msghdr_set(struct msghdr *hdr, struct iovec *iov, void *addr,
+           socklen_t addrlen)
+{
+    memset(hdr, 0, sizeof(struct msghdr));
+    hdr->msg_name = addr;
+    hdr->msg_namelen = addrlen;
+    hdr->msg_iov = iov;
+    hdr->msg_iovlen = 1;
+}
+
+static void
+dgram_got(verto_dgram *dgram, size_t i, size_t len, const struct msghdr *hdr)
+{
+    verto_datagram *msg = &dgram->msgs[i];
+
+    msg->data = dgram->iov[i].iov_base;
+    msg->len = len < dgram->maxsize ? len : dgram->maxsize;
+    msg->addr = hdr->msg_namelen > 0 ? (struct sockaddr *) &dgram->addrs[i]
+                                     : NULL;
+    msg->addrlen = hdr->msg_namelen;
+    msg->truncated = (hdr->msg_flags & MSG_TRUNC) != 0;
+}
+
+/* Receives up to a batch of datagrams into the ring.
+ * Returns the number received, or -errno. */
+static ssize_t
+dgram_do_read(verto_dgram *dgram)
+{
+    int fd = verto_get_fd(dgram->ev);
+    ssize_t n;
+    size_t i;
+
+    for (i = 0; i < dgram->batch; i++) {
+        dgram->iov[i].iov_base = dgram->ring + i * dgram->maxsize;
+        dgram->iov[i].iov_len = dgram->maxsize;
+    }
+
+#ifdef HAVE_RECVMMSG
+    for (i = 0; i < dgram->batch; i++) {
+        msghdr_set(&dgram->hdrs[i].msg_hdr, &dgram->iov[i], &dgram->addrs[i],
+                   sizeof(struct sockaddr_storage));
+    }
+
+    do {
+        n = recvmmsg(fd, dgram->hdrs, dgram->batch, 0, NULL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return -errno;
+
+    for (i = 0; i < (size_t) n; i++)
+        dgram_got(dgram, i, dgram->hdrs[i].msg_len, &dgram->hdrs[i].msg_hdr);
+#else
+    /* One system call per datagram */
+    for (n = 0; (size_t) n < dgram->batch; n++) {
+        struct msghdr msg;
+        ssize_t bytes;
+
+        msghdr_set(&msg, &dgram->iov[n], &dgram->addrs[n],
+                   sizeof(struct sockaddr_storage));
+        do {
+            bytes = recvmsg(fd, &msg, 0);
+        } while (bytes < 0 && errno == EINTR);
+        if (bytes < 0)
+            return n > 0 ? n : -errno;
+        dgram_got(dgram, n, bytes, &msg);
+    }
+#endif
+
+    return n;
+}
+
+static void
+dgram_pop(verto_dgram *dgram)
+{
+    dgram_out *out = dgram->head;
+
+    dgram->head = out->next;
+    if (!dgram->head)
+        dgram->tail = NULL;
+    dgram->pending--;
+    free(out);
+}
+
+/* Sends as much of the queue as the socket takes.  A datagram which can't
+ * be sent at all is dropped, and the error returned (0 otherwise). */
+static int
+dgram_do_write(verto_dgram *dgram)
+{
+    int fd = verto_get_fd(dgram->ev);
+    dgram_out *out;
+    ssize_t n;
+    int error;
+
+    while (dgram->head) {
+#ifdef HAVE_SENDMMSG
+        size_t count = 0;
+
+        for (out = dgram->head; out && count < dgram->batch; out = out->next) {
+            dgram->iov[count].iov_base = out->data;
+            dgram->iov[count].iov_len = out->len;
+            msghdr_set(&dgram->hdrs[count].msg_hdr, &dgram->iov[count],
+                       out->addrlen > 0 ? &out->addr : NULL, out->addrlen);
+            count++;
+        }
+
+        do {
+            n = sendmmsg(fd, dgram->hdrs, count, 0);
+        } while (n < 0 && errno == EINTR);
+#else
+        struct msghdr msg;
+
+        out = dgram->head;
+        dgram->iov[0].iov_base = out->data;
+        dgram->iov[0].iov_len = out->len;
+        msghdr_set(&msg, &dgram->iov[0], out->addrlen > 0 ? &out->addr : NULL,
+                   out->addrlen);
+
+        do {
+            n = sendmsg(fd, &msg, 0) < 0 ? -1 : 1;
+        } while (n < 0 && errno == EINTR);
+#endif
+
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            error = errno;
+            dgram_pop(dgram);
+            if (!dgram->head)
+                set_write_interest(dgram, 0);
+            return error;
+        }
+
+        while (n-- > 0)
+            dgram_pop(dgram);
+    }
+
+    set_write_interest(dgram, 0);
+    return 0;
+}
+
+static void
+dgram_callback(verto_ctx *ctx, verto_ev *ev)
+{
+    verto_dgram *dgram = verto_get_private(ev);
+    verto_ev_flag state = verto_get_fd_state(ev);
+    ssize_t n;
+    int error;
+
+    (void) ctx;
+
+    /* Each failed datagram is reported on its own, the others still go */
+    while (state & VERTO_EV_FLAG_IO_WRITE && dgram->head && !dgram->freed) {
+        error = dgram_do_write(dgram);
+        if (!error)
+            break;
+        dgram->callback(dgram, NULL, 0, error);
+    }
+
+    if (dgram->freed
+            || !(state & (VERTO_EV_FLAG_IO_READ | VERTO_EV_FLAG_IO_ERROR))
+            || !(verto_get_flags(ev) & VERTO_EV_FLAG_IO_READ))
+        return;
+
+    n = dgram_do_read(dgram);
+    if (n > 0)
+        dgram->callback(dgram, dgram->msgs, n, 0);
+    else if (n < 0 && n != -EAGAIN && n != -EWOULDBLOCK)
+        dgram->callback(dgram, NULL, 0, -n);
+}
+
+static void
+dgram_destroy(verto_dgram *dgram)
+{
+    while (dgram->head)
+        dgram_pop(dgram);
+    free(dgram->ring);
+    free(dgram->addrs);
+    free(dgram->msgs);
+    free(dgram->iov);
+#ifdef DGRAM_MMSG
+    free(dgram->hdrs);
+#endif
+    free(dgram);
+}
+
+static void
+dgram_free(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+
+    dgram_destroy(verto_get_private(ev));
+}
+
+verto_dgram *
+verto_dgram_new(verto_ctx *ctx, verto_ev_flag flags,
+                verto_dgram_callback *callback, int fd, size_t batch,
+                size_t maxsize)
+{
+    verto_dgram *dgram;
+
+    if (!callback)
+        return NULL;
+
+    dgram = malloc(sizeof(verto_dgram));
+    if (!dgram)
+        return NULL;
+    memset(dgram, 0, sizeof(verto_dgram));
+    dgram->callback = callback;
+    dgram->batch = batch > 0 ? batch : DGRAM_BATCH;
+    dgram->maxsize = maxsize > 0 ? maxsize : DGRAM_MAXSIZE;
+
+    /* The ring is allocated once, and received into in place */
+    dgram->ring = malloc(dgram->batch * dgram->maxsize);
+    dgram->addrs = malloc(dgram->batch * sizeof(struct sockaddr_storage));
+    dgram->msgs = malloc(dgram->batch * sizeof(verto_datagram));
+    dgram->iov = malloc(dgram->batch * sizeof(struct iovec));
+#ifdef DGRAM_MMSG
+    dgram->hdrs = malloc(dgram->batch * sizeof(struct mmsghdr));
+    if (!dgram->hdrs) {
+        dgram_destroy(dgram);
+        return NULL;
+    }
+#endif
+    if (!dgram->ring || !dgram->addrs || !dgram->msgs || !dgram->iov) {
+        dgram_destroy(dgram);
+        return NULL;
+    }
+
+    flags &= VERTO_EV_FLAG_PRIORITY_LOW | VERTO_EV_FLAG_PRIORITY_MEDIUM
+             | VERTO_EV_FLAG_PRIORITY_HIGH | VERTO_EV_FLAG_REINITIABLE
+             | VERTO_EV_FLAG_IO_CLOSE_FD;
+    flags |= VERTO_EV_FLAG_PERSIST | VERTO_EV_FLAG_IO_READ;
+
+    dgram->ev = verto_add_io(ctx, flags, dgram_callback, fd);
+    if (!dgram->ev) {
+        dgram_destroy(dgram);
+        return NULL;
+    }
+
+    verto_set_private(dgram->ev, dgram, dgram_free);
+    return dgram;
+}
+
+void
+verto_dgram_free(verto_dgram *dgram)
+{
+    if (!dgram || dgram->freed)
+        return;
+
+    dgram->freed = 1;
+    verto_del(dgram->ev);
+}
+
+verto_ev *
+verto_dgram_get_ev(const verto_dgram *dgram)
+{
+    return dgram->ev;
+}
+
+void
+verto_dgram_set_private(verto_dgram *dgram, void *priv)
+{
+    if (dgram)
+        dgram->priv = priv;
+}
+
+void *
+verto_dgram_get_private(const verto_dgram *dgram)
+{
+    return dgram->priv;
+}
+
+int
+verto_dgram_send(verto_dgram *dgram, const void *data, size_t len,
+                 const struct sockaddr *addr, socklen_t addrlen)
+{
+    dgram_out *out;
+
+    if (!dgram || dgram->freed || (!data && len > 0)
+            || addrlen > sizeof(struct sockaddr_storage)
+            || (!addr && addrlen > 0))
+        return 0;
+
+    out = malloc(offsetof(dgram_out, data) + (len > 0 ? len : 1));
+    if (!out)
+        return 0;
+    out->next = NULL;
+    out->len = len;
+    out->addrlen = addr ? addrlen : 0;
+    if (out->addrlen > 0)
+        memcpy(&out->addr, addr, addrlen);
+    if (len > 0)
+        memcpy(out->data, data, len);
+
+    if (dgram->tail)
+        dgram->tail->next = out;
+    else {
+        dgram->head = out;
+        set_write_interest(dgram, 1);
+    }
+    dgram->tail = out;
+    dgram->pending++;
+    return 1;
+}
+
+size_t
+verto_dgram_get_pending(const verto_dgram *dgram)
+{
+    return dgram->pending;
+}
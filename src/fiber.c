@@ -0,0 +1,309 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_UCONTEXT_H
+#include <ucontext.h>
+#include <sys/mman.h>
+#endif
+
+#include <verto.h>
+
+#ifdef HAVE_UCONTEXT_H
+
+#define FIBER_STACK_SIZE (256 * 1024)
+
+/* Stacks of finished fibers are kept per thread for reuse, up to: */
+#define FIBER_POOL_MAX 16
+
+typedef struct fiber_stack fiber_stack;
+struct fiber_stack {
+    fiber_stack *next;   /* Pooled stacks only; lives at the stack's base */
+    size_t size;
+};
+
+typedef struct verto_fiber verto_fiber;
+struct verto_fiber {
+    ucontext_t uc;
+    ucontext_t caller;   /* Where the fiber returns to when it suspends */
+    verto_ctx *ctx;
+    verto_fiber_func *func;
+    void *arg;
+    void *stack;         /* Usable area, above the guard page */
+    size_t stacksize;
+    verto_ev *wake;      /* Starts the fiber, and resumes it on yield */
+    verto_ev_flag state; /* verto_wait_io() result */
+    int done;
+};
+
+static __thread verto_fiber *current;
+static __thread fiber_stack *pool;
+static __thread size_t pooled;
+
+static size_t
+page_size(void)
+{
+    static size_t size;
+
+    if (size == 0)
+        size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+/* Maps a stack with a guard page below it, so an overflow faults rather
+ * than corrupting the memory next to it */
+static void *
+stack_get(size_t size)
+{
+    fiber_stack **cur, *stack;
+    char *base;
+
+    for (cur = &pool; *cur; cur = &(*cur)->next) {
+        if ((*cur)->size == size) {
+            stack = *cur;
+            *cur = stack->next;
+            pooled--;
+            return stack;
+        }
+    }
+
+    base = mmap(NULL, size + page_size(), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    if (mprotect(base, page_size(), PROT_NONE) != 0) {
+        munmap(base, size + page_size());
+        return NULL;
+    }
+
+    return base + page_size();
+}
+
+static void
+stack_put(void *mem, size_t size)
+{
+    fiber_stack *stack = mem;
+
+    if (pooled >= FIBER_POOL_MAX) {
+        munmap((char *) mem - page_size(), size + page_size());
+        return;
+    }
+
+    stack->next = pool;
+    stack->size = size;
+    pool = stack;
+    pooled++;
+}
+
+static void
+fiber_entry(void)
+{
+    verto_fiber *fiber = current;
+
+    fiber->func(fiber->arg);
+    fiber->done = 1;
+    /* Returning resumes fiber->caller through uc_link */
+}
+
+static void
+fiber_resume(verto_fiber *fiber)
+{
+    verto_fiber *prev = current;
+
+    current = fiber;
+    swapcontext(&fiber->caller, &fiber->uc);
+    current = prev;
+
+    /* Frees the fiber through fiber_free() */
+    if (fiber->done)
+        verto_del(fiber->wake);
+}
+
+static void
+fiber_suspend(void)
+{
+    verto_fiber *fiber = current;
+
+    swapcontext(&fiber->uc, &fiber->caller);
+}
+
+static void
+wake_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    verto_fiber *fiber = verto_get_private(ev);
+
+    (void) ctx;
+    if (verto_get_type(ev) == VERTO_EV_TYPE_IO)
+        fiber->state = verto_get_fd_state(ev);
+    fiber_resume(fiber);
+}
+
+/* Also called if the verto_ctx is freed while the fiber is blocked: its
+ * stack is simply dropped */
+static void
+fiber_free(verto_ctx *ctx, verto_ev *ev)
+{
+    verto_fiber *fiber = verto_get_private(ev);
+
+    (void) ctx;
+    stack_put(fiber->stack, fiber->stacksize);
+    free(fiber);
+}
+
+int
+verto_spawn(verto_ctx *ctx, verto_fiber_func *func, void *arg,
+            size_t stacksize)
+{
+    verto_fiber *fiber;
+
+    if (!ctx || !func)
+        return 0;
+
+    if (stacksize == 0)
+        stacksize = FIBER_STACK_SIZE;
+    stacksize = (stacksize + page_size() - 1) & ~(page_size() - 1);
+
+    fiber = malloc(sizeof(verto_fiber));
+    if (!fiber)
+        return 0;
+    memset(fiber, 0, sizeof(verto_fiber));
+    fiber->ctx = ctx;
+    fiber->func = func;
+    fiber->arg = arg;
+    fiber->stacksize = stacksize;
+
+    fiber->stack = stack_get(stacksize);
+    if (!fiber->stack) {
+        free(fiber);
+        return 0;
+    }
+
+    if (getcontext(&fiber->uc) != 0)
+        goto error;
+    fiber->uc.uc_stack.ss_sp = fiber->stack;
+    fiber->uc.uc_stack.ss_size = stacksize;
+    fiber->uc.uc_link = &fiber->caller;
+    makecontext(&fiber->uc, fiber_entry, 0);
+
+    fiber->wake = verto_add_user(ctx, VERTO_EV_FLAG_PERSIST, wake_cb);
+    if (!fiber->wake)
+        goto error;
+    verto_set_private(fiber->wake, fiber, fiber_free);
+
+    /* The fiber starts in the next iteration of the loop */
+    verto_trigger(fiber->wake);
+    return 1;
+
+error:
+    stack_put(fiber->stack, stacksize);
+    free(fiber);
+    return 0;
+}
+
+verto_ev_flag
+verto_wait_io(int fd, verto_ev_flag flags)
+{
+    verto_ev *ev;
+
+    if (!current)
+        return VERTO_EV_FLAG_NONE;
+
+    flags &= VERTO_EV_FLAG_IO_READ | VERTO_EV_FLAG_IO_WRITE;
+    ev = verto_add_io(current->ctx, flags, wake_cb, fd);
+    if (!ev)
+        return VERTO_EV_FLAG_NONE;
+    verto_set_private(ev, current, NULL);
+
+    current->state = VERTO_EV_FLAG_NONE;
+    fiber_suspend();
+    return current->state;
+}
+
+int
+verto_sleep(time_t ms)
+{
+    verto_ev *ev;
+
+    if (!current)
+        return 0;
+
+    ev = verto_add_timeout(current->ctx, VERTO_EV_FLAG_NONE, wake_cb, ms);
+    if (!ev)
+        return 0;
+    verto_set_private(ev, current, NULL);
+
+    fiber_suspend();
+    return 1;
+}
+
+int
+verto_yield(void)
+{
+    if (!current)
+        return 0;
+
+    verto_trigger(current->wake);
+    fiber_suspend();
+    return 1;
+}
+
+#else /* HAVE_UCONTEXT_H */
+
+int
+verto_spawn(verto_ctx *ctx, verto_fiber_func *func, void *arg,
+            size_t stacksize)
+{
+    (void) ctx;
+    (void) func;
+    (void) arg;
+    (void) stacksize;
+    return 0;
+}
+
+verto_ev_flag
+verto_wait_io(int fd, verto_ev_flag flags)
+{
+    (void) fd;
+    (void) flags;
+    return VERTO_EV_FLAG_NONE;
+}
+
+int
+verto_sleep(time_t ms)
+{
+    (void) ms;
+    return 0;
+}
+
+int
+verto_yield(void)
+{
+    return 0;
+}
+
+#endif /* HAVE_UCONTEXT_H */
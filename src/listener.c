@@ -0,0 +1,163 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/socket.h>
+
+#include <verto.h>
+
+typedef struct {
+    verto_accept_callback *callback;
+    size_t budget;     /* Maximum connections accepted per wakeup */
+    int reserve;       /* Spare fd, given up to drop a connection on EMFILE */
+} listener;
+
+static int
+listener_accept(int fd)
+{
+#ifdef HAVE_ACCEPT4
+    return accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int flags;
+
+    fd = accept(fd, NULL, NULL);
+    if (fd < 0)
+        return fd;
+
+    flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0
+            || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#endif
+}
+
+static int
+listener_reserve(void)
+{
+    return open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+static void
+listener_callback(verto_ctx *ctx, verto_ev *ev)
+{
+    listener *l = verto_get_private(ev);
+    verto_handle handle = verto_get_handle(ev);
+    int lfd = verto_get_fd(ev), fd;
+    size_t i;
+
+    for (i = 0; i < l->budget; i++) {
+        fd = listener_accept(lfd);
+        if (fd >= 0) {
+            l->callback(ctx, ev, fd);
+
+            /* The callback may have deleted the listener */
+            if (verto_find_handle(ctx, handle) != ev)
+                return;
+            continue;
+        }
+
+        switch (errno) {
+            case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+            case EWOULDBLOCK:
+#endif
+                return;
+            case EINTR:
+            case ECONNABORTED:
+            case EPROTO:
+                continue;
+            case EMFILE:
+            case ENFILE:
+                /* The pending connection would keep the listener ready, and
+                 * the loop spinning: free a descriptor to accept and drop
+                 * it. */
+                if (l->reserve < 0)
+                    return;
+                close(l->reserve);
+                fd = listener_accept(lfd);
+                if (fd >= 0)
+                    close(fd);
+                l->reserve = listener_reserve();
+                if (fd < 0)
+                    return;
+                continue;
+            default:
+                l->callback(ctx, ev, -1);
+                return;
+        }
+    }
+}
+
+static void
+listener_free(verto_ctx *ctx, verto_ev *ev)
+{
+    listener *l = verto_get_private(ev);
+
+    (void) ctx;
+
+    if (l->reserve >= 0)
+        close(l->reserve);
+    free(l);
+}
+
+verto_ev *
+verto_add_listener(verto_ctx *ctx, int listen_fd, verto_ev_flag flags,
+                   verto_accept_callback *on_accept, size_t max_per_wakeup)
+{
+    listener *l;
+    verto_ev *ev;
+
+    if (!ctx || listen_fd < 0 || !on_accept)
+        return NULL;
+
+    l = malloc(sizeof(listener));
+    if (!l)
+        return NULL;
+    memset(l, 0, sizeof(listener));
+    l->callback = on_accept;
+    l->budget = max_per_wakeup > 0 ? max_per_wakeup : 1;
+    l->reserve = listener_reserve();
+
+    flags &= VERTO_EV_FLAG_PRIORITY_LOW | VERTO_EV_FLAG_PRIORITY_MEDIUM
+             | VERTO_EV_FLAG_PRIORITY_HIGH | VERTO_EV_FLAG_REINITIABLE
+             | VERTO_EV_FLAG_IO_CLOSE_FD;
+    flags |= VERTO_EV_FLAG_PERSIST | VERTO_EV_FLAG_IO_READ;
+
+    ev = verto_add_io(ctx, flags, listener_callback, listen_fd);
+    if (!ev) {
+        if (l->reserve >= 0)
+            close(l->reserve);
+        free(l);
+        return NULL;
+    }
+    verto_set_private(ev, l, listener_free);
+    return ev;
+}
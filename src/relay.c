@@ -0,0 +1,418 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/stat.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+#include <verto.h>
+
+/* Size of the user-space buffer when the kernel can't do the copy */
+#define RELAY_BUF_SIZE 65536
+
+/* Maximum number of bytes moved per wakeup, so that one fast relay cannot
+ * starve the rest of the loop */
+#define RELAY_BUDGET (1024 * 1024)
+
+struct verto_relay {
+    verto_ev *in;      /* NULL if the input is a regular file */
+    verto_ev *out;
+    verto_relay_callback *callback;
+    void *priv;
+    int infd;
+    int outfd;
+    int pipe[2];       /* splice() mode only, otherwise -1 */
+    char *buf;         /* Copy mode only */
+    size_t bufsize;    /* Capacity of the pipe or of buf */
+    size_t bufstart;   /* Copy mode: offset of the first buffered byte */
+    size_t buffered;   /* Bytes read but not yet written */
+    size_t count;      /* Total bytes to relay, 0 for "until EOF" */
+    size_t read;       /* Bytes read from infd */
+    size_t written;    /* Bytes written to outfd */
+    int usesendfile;
+    int eof;
+    int done;
+};
+
+static int
+relay_copy_mode(verto_relay *relay)
+{
+    if (relay->pipe[0] >= 0) {
+        close(relay->pipe[0]);
+        close(relay->pipe[1]);
+        relay->pipe[0] = relay->pipe[1] = -1;
+    }
+
+    relay->buf = malloc(RELAY_BUF_SIZE);
+    if (!relay->buf)
+        return ENOMEM;
+    relay->bufsize = RELAY_BUF_SIZE;
+    return 0;
+}
+
+static size_t
+relay_want(const verto_relay *relay, size_t want)
+{
+    if (relay->count > 0 && relay->count - relay->read < want)
+        want = relay->count - relay->read;
+    return want;
+}
+
+static void
+relay_got(verto_relay *relay, ssize_t bytes)
+{
+    if (bytes == 0)
+        relay->eof = 1;
+    relay->read += bytes;
+    if (relay->count > 0 && relay->read >= relay->count)
+        relay->eof = 1;
+}
+
+/* Moves data from infd into the pipe/buffer.
+ * Returns the number of bytes moved, or -errno. */
+static ssize_t
+relay_fill(verto_relay *relay)
+{
+    size_t want = relay_want(relay, relay->bufsize - relay->buffered);
+    ssize_t bytes;
+
+#ifdef HAVE_SPLICE
+    if (relay->pipe[0] >= 0) {
+        do {
+            bytes = splice(relay->infd, NULL, relay->pipe[1], NULL, want,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        } while (bytes < 0 && errno == EINTR);
+
+        /* Not every fd can be spliced, so fall back before the first byte */
+        if (bytes < 0 && errno == EINVAL && relay->read == 0) {
+            bytes = relay_copy_mode(relay);
+            if (bytes != 0)
+                return -bytes;
+            return relay_fill(relay);
+        }
+    } else
+#endif
+    {
+        if (relay->bufstart > 0 && relay->buffered > 0)
+            memmove(relay->buf, relay->buf + relay->bufstart, relay->buffered);
+        relay->bufstart = 0;
+
+        do {
+            bytes = read(relay->infd, relay->buf + relay->buffered, want);
+        } while (bytes < 0 && errno == EINTR);
+    }
+
+    if (bytes < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -errno;
+
+    relay_got(relay, bytes);
+    relay->buffered += bytes;
+    return bytes;
+}
+
+/* Moves data from the pipe/buffer to outfd.
+ * Returns the number of bytes moved, or -errno. */
+static ssize_t
+relay_drain(verto_relay *relay)
+{
+    ssize_t bytes;
+
+#ifdef HAVE_SPLICE
+    if (relay->pipe[0] >= 0) {
+        do {
+            bytes = splice(relay->pipe[0], NULL, relay->outfd, NULL,
+                           relay->buffered,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        } while (bytes < 0 && errno == EINTR);
+    } else
+#endif
+    {
+        do {
+            bytes = write(relay->outfd, relay->buf + relay->bufstart,
+                          relay->buffered);
+        } while (bytes < 0 && errno == EINTR);
+        if (bytes > 0)
+            relay->bufstart += bytes;
+    }
+
+    if (bytes < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -errno;
+
+    relay->buffered -= bytes;
+    relay->written += bytes;
+    return bytes;
+}
+
+#ifdef HAVE_SENDFILE
+/* Regular file to anything: the kernel does the whole copy.
+ * Returns the number of bytes moved, or -errno. */
+static ssize_t
+relay_sendfile(verto_relay *relay)
+{
+    ssize_t bytes;
+
+    do {
+        bytes = sendfile(relay->outfd, relay->infd, NULL,
+                         relay_want(relay, RELAY_BUDGET));
+    } while (bytes < 0 && errno == EINTR);
+
+    if (bytes < 0 && (errno == EINVAL || errno == ENOSYS)
+            && relay->read == 0) {
+        relay->usesendfile = 0;
+        bytes = relay_copy_mode(relay);
+        return bytes == 0 ? 0 : -bytes;
+    }
+
+    if (bytes < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -errno;
+
+    relay_got(relay, bytes);
+    relay->written += bytes;
+    return bytes;
+}
+#endif
+
+static void
+relay_interest(verto_ev *ev, verto_ev_flag flag, int on)
+{
+    verto_ev_flag flags;
+
+    if (!ev)
+        return;
+
+    /* verto_set_flags() is a no-op if nothing changes */
+    flags = verto_get_flags(ev);
+    verto_set_flags(ev, on ? flags | flag : flags & ~flag);
+}
+
+static void
+relay_pump(verto_relay *relay)
+{
+    size_t moved = 0;
+    ssize_t bytes = 0;
+
+    while (moved < RELAY_BUDGET) {
+        ssize_t progress = 0;
+
+#ifdef HAVE_SENDFILE
+        if (relay->usesendfile) {
+            if (relay->eof)
+                break;
+            bytes = relay_sendfile(relay);
+            if (bytes <= 0)
+                break;
+            moved += bytes;
+            continue;
+        }
+#endif
+
+        if (!relay->eof && relay->buffered < relay->bufsize) {
+            bytes = relay_fill(relay);
+            if (bytes < 0)
+                break;
+            progress += bytes;
+        }
+
+        if (relay->buffered > 0) {
+            bytes = relay_drain(relay);
+            if (bytes < 0)
+                break;
+            progress += bytes;
+            moved += bytes;
+        }
+
+        if (progress == 0)
+            break;
+        bytes = 0;
+    }
+
+    if (bytes < 0 || (relay->eof && relay->buffered == 0)) {
+        relay->done = 1;
+        relay_interest(relay->in, VERTO_EV_FLAG_IO_READ, 0);
+        relay_interest(relay->out, VERTO_EV_FLAG_IO_WRITE, 0);
+        relay->callback(relay, bytes < 0 ? (int) -bytes : 0);
+        return; /* The callback may have freed the relay */
+    }
+
+    /* Back-pressure: stop reading while the pipe/buffer is full and only
+     * wait for writability while there is something to write. */
+    relay_interest(relay->in, VERTO_EV_FLAG_IO_READ,
+                   !relay->eof && relay->buffered < relay->bufsize);
+    relay_interest(relay->out, VERTO_EV_FLAG_IO_WRITE,
+                   relay->usesendfile || relay->buffered > 0
+                   || (!relay->in && !relay->eof));
+}
+
+static void
+relay_callback(verto_ctx *ctx, verto_ev *ev)
+{
+    verto_relay *relay = verto_get_private(ev);
+
+    (void) ctx;
+
+    if (!relay->done)
+        relay_pump(relay);
+}
+
+static void
+relay_destroy(verto_relay *relay)
+{
+    if (relay->pipe[0] >= 0) {
+        close(relay->pipe[0]);
+        close(relay->pipe[1]);
+    }
+    free(relay->buf);
+    free(relay);
+}
+
+static void
+relay_free(verto_ctx *ctx, verto_ev *ev)
+{
+    verto_relay *relay = verto_get_private(ev);
+
+    (void) ctx;
+
+    if (relay->in == ev)
+        relay->in = NULL;
+    if (relay->out == ev)
+        relay->out = NULL;
+
+    /* The relay goes away with the last of its events */
+    if (!relay->in && !relay->out)
+        relay_destroy(relay);
+}
+
+verto_relay *
+verto_relay_new(verto_ctx *ctx, verto_ev_flag flags,
+                verto_relay_callback *callback, int infd, int outfd,
+                size_t count)
+{
+    verto_relay *relay;
+    struct stat st;
+    int isfile;
+
+    if (!ctx || !callback || infd < 0 || outfd < 0 || fstat(infd, &st) != 0)
+        return NULL;
+    isfile = S_ISREG(st.st_mode);
+
+    relay = malloc(sizeof(verto_relay));
+    if (!relay)
+        return NULL;
+    memset(relay, 0, sizeof(verto_relay));
+    relay->callback = callback;
+    relay->infd = infd;
+    relay->outfd = outfd;
+    relay->count = count;
+    relay->pipe[0] = relay->pipe[1] = -1;
+
+#ifdef HAVE_SENDFILE
+    relay->usesendfile = isfile;
+#endif
+#if defined(HAVE_SPLICE) && defined(HAVE_PIPE2)
+    if (!relay->usesendfile
+            && pipe2(relay->pipe, O_NONBLOCK | O_CLOEXEC) == 0) {
+#ifdef F_GETPIPE_SZ
+        int size = fcntl(relay->pipe[0], F_GETPIPE_SZ);
+        relay->bufsize = size > 0 ? (size_t) size : RELAY_BUF_SIZE;
+#else
+        relay->bufsize = RELAY_BUF_SIZE;
+#endif
+    }
+#endif
+    if (!relay->usesendfile && relay->pipe[0] < 0
+            && relay_copy_mode(relay) != 0) {
+        relay_destroy(relay);
+        return NULL;
+    }
+
+    flags &= VERTO_EV_FLAG_PRIORITY_LOW | VERTO_EV_FLAG_PRIORITY_MEDIUM
+             | VERTO_EV_FLAG_PRIORITY_HIGH | VERTO_EV_FLAG_REINITIABLE;
+    flags |= VERTO_EV_FLAG_PERSIST;
+
+    /* Regular files are always readable (and can't be polled with epoll),
+     * so they are read whenever the output is writable. */
+    relay->out = verto_add_io(ctx, flags | VERTO_EV_FLAG_IO_WRITE,
+                              relay_callback, outfd);
+    if (!relay->out) {
+        relay_destroy(relay);
+        return NULL;
+    }
+    verto_set_private(relay->out, relay, relay_free);
+
+    if (!isfile) {
+        relay->in = verto_add_io(ctx, flags | VERTO_EV_FLAG_IO_READ,
+                                 relay_callback, infd);
+        if (!relay->in) {
+            verto_del(relay->out);
+            return NULL;
+        }
+        verto_set_private(relay->in, relay, relay_free);
+
+        /* Nothing to write until something was read */
+        relay_interest(relay->out, VERTO_EV_FLAG_IO_WRITE, 0);
+    }
+
+    return relay;
+}
+
+void
+verto_relay_free(verto_relay *relay)
+{
+    verto_ev *in, *out;
+
+    if (!relay)
+        return;
+
+    /* Deleting the last event frees the relay, so don't touch it after */
+    in = relay->in;
+    out = relay->out;
+    relay->done = 1;
+    verto_del(in);
+    verto_del(out);
+}
+
+size_t
+verto_relay_get_transferred(const verto_relay *relay)
+{
+    return relay->written;
+}
+
+void
+verto_relay_set_private(verto_relay *relay, void *priv)
+{
+    if (relay)
+        relay->priv = priv;
+}
+
+void *
+verto_relay_get_private(const verto_relay *relay)
+{
+    return relay->priv;
+}
@@ -0,0 +1,529 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>
+
+#include "sigfd.h"
+
+#ifdef HAVE_SIGFD
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#define mutex_lock(x)   pthread_mutex_lock(x)
+#define mutex_unlock(x) pthread_mutex_unlock(x)
+#define thread_sigmask(how, set, old) pthread_sigmask(how, set, old)
+#else
+#define mutex_lock(x)
+#define mutex_unlock(x)
+#define thread_sigmask(how, set, old) sigprocmask(how, set, old)
+#endif
+
+#ifdef HAVE_SIGFD
+
+struct sigfd_port {
+    sigfd_port *next;
+    int efd;
+    int linked;                  /* On ports, i.e. not left over by fork() */
+    int dirty;                   /* Has pending deliveries */
+    unsigned int refs[NSIG];     /* Watches per signal */
+    unsigned int pending[NSIG];  /* Deliveries not taken yet */
+};
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t sigfd_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static sigfd_port *ports;
+static int sfd = -1;
+static sigset_t watched;           /* Signals read through sfd */
+static unsigned int watchers[NSIG]; /* Ports watching each signal */
+
+/* A watched signal must stay blocked in every thread that watches it, or the
+ * kernel may deliver it to that thread instead of queueing it on sfd. */
+static __thread unsigned int thread_refs[NSIG];   /* Ports of this thread */
+static __thread unsigned char thread_blocked[NSIG]; /* Blocked by us here */
+
+static int
+thread_block(int signum)
+{
+    sigset_t set, old;
+
+    if (thread_refs[signum] == 0) {
+        sigemptyset(&set);
+        sigaddset(&set, signum);
+        if (thread_sigmask(SIG_BLOCK, &set, &old) != 0)
+            return 0;
+        /* Still set if we blocked it before fork() */
+        if (!sigismember(&old, signum))
+            thread_blocked[signum] = 1;
+    }
+    thread_refs[signum]++;
+    return 1;
+}
+
+static void
+thread_unblock(int signum)
+{
+    sigset_t set;
+
+    if (thread_refs[signum] == 0 || --thread_refs[signum] > 0)
+        return;
+
+    /* Give the signal back its previous disposition in this thread */
+    if (thread_blocked[signum]) {
+        thread_blocked[signum] = 0;
+        sigemptyset(&set);
+        sigaddset(&set, signum);
+        thread_sigmask(SIG_UNBLOCK, &set, NULL);
+    }
+}
+
+/* Puts a new file under the descriptor fd, which keeps its number */
+static int
+replace_fd(int fd, int newfd)
+{
+    if (newfd < 0)
+        return 0;
+    if (dup3(newfd, fd, O_CLOEXEC) < 0) {
+        close(newfd);
+        return 0;
+    }
+    close(newfd);
+    return 1;
+}
+
+/* In a child, the signalfd and the ports' eventfds are shared with the
+ * parent: reading them would take the parent's wakeups, and changing the
+ * signalfd's mask would change the parent's.  So the child gets a signalfd
+ * of its own, and forgets the ports until sigfd_port_reinitialize(). */
+static void
+forget_parent(void)
+{
+    sigfd_port *port;
+
+    for (port = ports; port; port = port->next)
+        port->linked = 0;
+    ports = NULL;
+
+    memset(watchers, 0, sizeof(watchers));
+    memset(thread_refs, 0, sizeof(thread_refs));
+    sigemptyset(&watched);
+    if (sfd >= 0
+            && !replace_fd(sfd, signalfd(-1, &watched,
+                                         SFD_NONBLOCK | SFD_CLOEXEC))) {
+        close(sfd);
+        sfd = -1;
+    }
+}
+
+#ifdef HAVE_PTHREAD
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void
+atfork_prepare(void)
+{
+    pthread_mutex_lock(&sigfd_mutex);
+}
+
+static void
+atfork_parent(void)
+{
+    pthread_mutex_unlock(&sigfd_mutex);
+}
+
+static void
+atfork_child(void)
+{
+    forget_parent();
+    pthread_mutex_unlock(&sigfd_mutex);
+}
+
+static void
+atfork_register(void)
+{
+    pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
+}
+
+#define check_fork()
+#else
+static pid_t owner; /* The process the ports belong to */
+
+/* Without pthread_atfork(), notice the fork() when next called */
+static void
+check_fork(void)
+{
+    pid_t pid = getpid();
+
+    if (owner != pid) {
+        if (owner != 0)
+            forget_parent();
+        owner = pid;
+    }
+}
+#endif
+
+sigfd_port *
+sigfd_port_new(void)
+{
+    sigfd_port *port;
+
+    port = malloc(sizeof(sigfd_port));
+    if (!port)
+        return NULL;
+    memset(port, 0, sizeof(sigfd_port));
+
+    port->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (port->efd < 0) {
+        free(port);
+        return NULL;
+    }
+
+#ifdef HAVE_PTHREAD
+    pthread_once(&atfork_once, atfork_register);
+#endif
+
+    mutex_lock(&sigfd_mutex);
+    check_fork();
+    if (sfd < 0) {
+        sigemptyset(&watched);
+        sfd = signalfd(-1, &watched, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (sfd < 0) {
+            mutex_unlock(&sigfd_mutex);
+            close(port->efd);
+            free(port);
+            return NULL;
+        }
+    }
+    port->next = ports;
+    ports = port;
+    port->linked = 1;
+    mutex_unlock(&sigfd_mutex);
+
+    return port;
+}
+
+int
+sigfd_port_reinitialize(sigfd_port *port)
+{
+    int i;
+
+    mutex_lock(&sigfd_mutex);
+    check_fork();
+    if (port->linked) {
+        mutex_unlock(&sigfd_mutex);
+        return 1;
+    }
+
+    if (sfd < 0 || !replace_fd(port->efd,
+                               eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))) {
+        mutex_unlock(&sigfd_mutex);
+        return 0;
+    }
+    memset(port->pending, 0, sizeof(port->pending));
+    port->dirty = 0;
+
+    /* Watch the port's signals again, from this thread */
+    for (i = 1; i < NSIG; i++) {
+        if (port->refs[i] == 0)
+            continue;
+        thread_block(i);
+        sigaddset(&watched, i);
+        watchers[i] += port->refs[i];
+    }
+    signalfd(sfd, &watched, 0);
+
+    port->next = ports;
+    ports = port;
+    port->linked = 1;
+    mutex_unlock(&sigfd_mutex);
+
+    return 1;
+}
+
+void
+sigfd_port_free(sigfd_port *port)
+{
+    sigfd_port **cur;
+    int i;
+
+    if (!port)
+        return;
+
+    for (i = 1; i < NSIG; i++) {
+        while (port->refs[i] > 0)
+            sigfd_port_unwatch(port, i);
+    }
+
+    mutex_lock(&sigfd_mutex);
+    for (cur = &ports; *cur; cur = &(*cur)->next) {
+        if (*cur == port) {
+            *cur = port->next;
+            break;
+        }
+    }
+    mutex_unlock(&sigfd_mutex);
+
+    close(port->efd);
+    free(port);
+}
+
+int
+sigfd_port_get_fd(const sigfd_port *port)
+{
+    return port->efd;
+}
+
+int
+sigfd_get_fd(void)
+{
+    return sfd;
+}
+
+int
+sigfd_port_watch(sigfd_port *port, int signum)
+{
+    if (signum <= 0 || signum >= NSIG)
+        return 0;
+
+    mutex_lock(&sigfd_mutex);
+    check_fork();
+    if (!port->linked) {
+        mutex_unlock(&sigfd_mutex);
+        return 0;
+    }
+
+    if (port->refs[signum] == 0 && !thread_block(signum)) {
+        mutex_unlock(&sigfd_mutex);
+        return 0;
+    }
+
+    if (watchers[signum] == 0) {
+        sigaddset(&watched, signum);
+        if (signalfd(sfd, &watched, 0) < 0) {
+            sigdelset(&watched, signum);
+            if (port->refs[signum] == 0)
+                thread_unblock(signum);
+            mutex_unlock(&sigfd_mutex);
+            return 0;
+        }
+    }
+    watchers[signum]++;
+    port->refs[signum]++;
+    mutex_unlock(&sigfd_mutex);
+
+    return 1;
+}
+
+unsigned int
+sigfd_port_unwatch(sigfd_port *port, int signum)
+{
+    unsigned int left = 0;
+    int i;
+
+    mutex_lock(&sigfd_mutex);
+    check_fork();
+    if (signum > 0 && signum < NSIG && port->refs[signum] > 0) {
+        if (--port->refs[signum] == 0) {
+            port->pending[signum] = 0;
+            if (port->linked)
+                thread_unblock(signum);
+        }
+
+        /* The parent's ports hold no watches here */
+        if (port->linked && --watchers[signum] == 0) {
+            sigdelset(&watched, signum);
+            signalfd(sfd, &watched, 0);
+        }
+    }
+
+    for (i = 1; i < NSIG; i++)
+        left += port->refs[i];
+    mutex_unlock(&sigfd_mutex);
+
+    return left;
+}
+
+void
+sigfd_read(sigfd_port *self)
+{
+    struct signalfd_siginfo info[16];
+    sigfd_port *port;
+    uint64_t one = 1;
+    ssize_t n;
+    size_t i;
+
+    mutex_lock(&sigfd_mutex);
+    check_fork();
+    for (;;) {
+        n = read(sfd, info, sizeof(info));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < (ssize_t) sizeof(info[0]))
+            break;
+
+        /* Deliveries of the same signal coalesce into a count */
+        for (i = 0; i < n / sizeof(info[0]); i++) {
+            int signum = info[i].ssi_signo;
+
+            if (signum <= 0 || signum >= NSIG)
+                continue;
+
+            for (port = ports; port; port = port->next) {
+                if (port->refs[signum] > 0) {
+                    port->pending[signum]++;
+                    port->dirty = 1;
+                }
+            }
+        }
+    }
+
+    for (port = ports; port; port = port->next) {
+        if (port->dirty && port != self) {
+            if (write(port->efd, &one, sizeof(one)) < 0) {
+                /* The counter is only ever full if the port is not
+                 * being read, in which case it is already readable. */
+            }
+        }
+    }
+    mutex_unlock(&sigfd_mutex);
+}
+
+int
+sigfd_port_take(sigfd_port *port, unsigned int *counts)
+{
+    uint64_t value;
+    int dirty;
+
+    mutex_lock(&sigfd_mutex);
+    check_fork();
+
+    /* Left over by fork(), the eventfd is the parent's */
+    if (!port->linked) {
+        mutex_unlock(&sigfd_mutex);
+        return 0;
+    }
+
+    if (read(port->efd, &value, sizeof(value)) < 0) {
+        /* EAGAIN: we were not woken up through the eventfd */
+    }
+
+    dirty = port->dirty;
+    if (dirty) {
+        memcpy(counts, port->pending, sizeof(port->pending));
+        memset(port->pending, 0, sizeof(port->pending));
+        port->dirty = 0;
+    }
+    mutex_unlock(&sigfd_mutex);
+
+    return dirty;
+}
+
+void
+sigfd_cleanup(void)
+{
+    mutex_lock(&sigfd_mutex);
+    if (sfd >= 0 && !ports) {
+        close(sfd);
+        sfd = -1;
+    }
+    mutex_unlock(&sigfd_mutex);
+}
+
+#else /* HAVE_SIGFD */
+
+sigfd_port *
+sigfd_port_new(void)
+{
+    return NULL;
+}
+
+void
+sigfd_port_free(sigfd_port *port)
+{
+    (void) port;
+}
+
+int
+sigfd_port_get_fd(const sigfd_port *port)
+{
+    (void) port;
+    return -1;
+}
+
+int
+sigfd_get_fd(void)
+{
+    return -1;
+}
+
+int
+sigfd_port_reinitialize(sigfd_port *port)
+{
+    (void) port;
+    return 1;
+}
+
+int
+sigfd_port_watch(sigfd_port *port, int signum)
+{
+    (void) port;
+    (void) signum;
+    return 0;
+}
+
+unsigned int
+sigfd_port_unwatch(sigfd_port *port, int signum)
+{
+    (void) port;
+    (void) signum;
+    return 0;
+}
+
+void
+sigfd_read(sigfd_port *self)
+{
+    (void) self;
+}
+
+int
+sigfd_port_take(sigfd_port *port, unsigned int *counts)
+{
+    (void) port;
+    (void) counts;
+    return 0;
+}
+
+void
+sigfd_cleanup(void)
+{
+}
+
+#endif /* HAVE_SIGFD */
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SIGFD_H_
+#define SIGFD_H_
+
+#include <signal.h>
+
+#ifndef NSIG
+#define NSIG 65
+#endif
+
+#if defined(HAVE_SYS_SIGNALFD_H) && defined(HAVE_SYS_EVENTFD_H)
+#define HAVE_SIGFD 1
+#endif
+
+/* A process-wide signalfd(2) which reads every signal that any verto_ctx
+ * watches, and fans the deliveries out to per-context ports.  A port is an
+ * eventfd(2) which is signalled when deliveries are pending for it.
+ *
+ * Only the port functions and sigfd_read() may be called concurrently
+ * from several threads; a port itself belongs to a single thread. */
+typedef struct sigfd_port sigfd_port;
+
+/* Returns NULL if signalfd(2) is not available */
+sigfd_port *
+sigfd_port_new(void);
+
+void
+sigfd_port_free(sigfd_port *port);
+
+/* After fork(), the child's ports are left over from the parent and
+ * deliver nothing until this gives them an eventfd of their own, under the
+ * same descriptor, and watches their signals again in the calling thread */
+int
+sigfd_port_reinitialize(sigfd_port *port);
+
+/* The port's eventfd, readable when deliveries are pending */
+int
+sigfd_port_get_fd(const sigfd_port *port);
+
+/* The shared signalfd, readable when any watched signal arrived */
+int
+sigfd_get_fd(void);
+
+/* Block signum in the calling thread and route it to the port */
+int
+sigfd_port_watch(sigfd_port *port, int signum);
+
+/* Returns the number of watches the port still has */
+unsigned int
+sigfd_port_unwatch(sigfd_port *port, int signum);
+
+/* Reads the signalfd and hands the deliveries to the ports; the ports
+ * other than self are woken up through their eventfd */
+void
+sigfd_read(sigfd_port *self);
+
+/* Moves the pending delivery counts of the port into counts[NSIG] and
+ * returns non-zero if there were any */
+int
+sigfd_port_take(sigfd_port *port, unsigned int *counts);
+
+void
+sigfd_cleanup(void);
+
+#endif /* SIGFD_H_ */
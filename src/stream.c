@@ -0,0 +1,477 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <verto.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
+/* Size of the buffers data is read into */
+#define STREAM_BUF_SIZE 16384
+
+/* Maximum number of iovecs passed to a single writev() */
+#define STREAM_MAX_IOV (IOV_MAX < 64 ? IOV_MAX : 64)
+
+typedef struct stream_buf stream_buf;
+struct stream_buf {
+    stream_buf *next;
+    char *data;
+    size_t start;  /* First byte not yet consumed/written */
+    size_t end;    /* One past the last valid byte */
+    size_t size;   /* Capacity of data; 0 if data is borrowed */
+    void (*release)(void *data);
+};
+
+typedef struct {
+    stream_buf *head;
+    stream_buf *tail;
+    size_t len;
+} stream_queue;
+
+struct verto_stream {
+    verto_ev *ev;
+    verto_stream_callback *callback;
+    void *priv;
+    stream_queue in;
+    stream_queue out;
+    stream_buf *spare;
+    int eof;
+    int broken;    /* A write failed: the output is dropped */
+    int freed;
+};
+
+static stream_buf *
+buf_new(size_t size)
+{
+    stream_buf *buf;
+
+    buf = malloc(sizeof(stream_buf) + size);
+    if (!buf)
+        return NULL;
+
+    memset(buf, 0, sizeof(stream_buf));
+    buf->data = (char *) (buf + 1);
+    buf->size = size;
+    return buf;
+}
+
+static void
+buf_free(stream_buf *buf)
+{
+    if (buf->release)
+        buf->release(buf->data);
+    free(buf);
+}
+
+static void
+queue_push(stream_queue *q, stream_buf *buf)
+{
+    buf->next = NULL;
+    if (q->tail)
+        q->tail->next = buf;
+    else
+        q->head = buf;
+    q->tail = buf;
+    q->len += buf->end - buf->start;
+}
+
+/* Drops len bytes from the front of q, recycling one emptied buffer */
+static void
+queue_drop(verto_stream *stream, stream_queue *q, size_t len)
+{
+    stream_buf *buf;
+
+    if (len > q->len)
+        len = q->len;
+    q->len -= len;
+
+    while ((buf = q->head)) {
+        size_t avail = buf->end - buf->start;
+
+        if (len < avail) {
+            buf->start += len;
+            break;
+        }
+
+        len -= avail;
+        q->head = buf->next;
+        if (!q->head)
+            q->tail = NULL;
+
+        if (!stream->spare && buf->size == STREAM_BUF_SIZE) {
+            buf->start = buf->end = 0;
+            stream->spare = buf;
+        } else
+            buf_free(buf);
+    }
+}
+
+static void
+queue_clear(stream_queue *q)
+{
+    stream_buf *buf, *next;
+
+    for (buf = q->head; buf; buf = next) {
+        next = buf->next;
+        buf_free(buf);
+    }
+    q->head = q->tail = NULL;
+    q->len = 0;
+}
+
+static void
+set_write_interest(verto_stream *stream, int on)
+{
+    verto_ev_flag flags = verto_get_flags(stream->ev);
+
+    if (on)
+        verto_set_flags(stream->ev, flags | VERTO_EV_FLAG_IO_WRITE);
+    else
+        verto_set_flags(stream->ev, flags & ~VERTO_EV_FLAG_IO_WRITE);
+}
+
+static int
+stream_do_read(verto_stream *stream)
+{
+    struct iovec iov[2];
+    stream_buf *tail = stream->in.tail;
+    size_t tailroom = 0;
+    int iovcnt = 0;
+    ssize_t bytes;
+
+    /* Fill the free space at the end of the last buffer first, then spill
+     * into a fresh one.  The fresh one is only queued if it got data. */
+    if (tail && tail->size > tail->end) {
+        tailroom = tail->size - tail->end;
+        iov[iovcnt].iov_base = tail->data + tail->end;
+        iov[iovcnt++].iov_len = tailroom;
+    }
+
+    if (!stream->spare)
+        stream->spare = buf_new(STREAM_BUF_SIZE);
+    if (stream->spare) {
+        iov[iovcnt].iov_base = stream->spare->data;
+        iov[iovcnt++].iov_len = stream->spare->size;
+    } else if (iovcnt == 0)
+        return ENOMEM;
+
+    do {
+        bytes = readv(verto_get_fd(stream->ev), iov, iovcnt);
+    } while (bytes < 0 && errno == EINTR);
+
+    if (bytes < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : errno;
+
+    if (bytes == 0) {
+        stream->eof = 1;
+        return 0;
+    }
+
+    if (tailroom > 0) {
+        size_t n = (size_t) bytes < tailroom ? (size_t) bytes : tailroom;
+
+        tail->end += n;
+        stream->in.len += n;
+        bytes -= n;
+    }
+
+    if (bytes > 0) {
+        stream_buf *buf = stream->spare;
+
+        stream->spare = NULL;
+        buf->end = bytes;
+        queue_push(&stream->in, buf);
+    }
+
+    return 0;
+}
+
+static int
+stream_do_write(verto_stream *stream)
+{
+    struct iovec iov[STREAM_MAX_IOV];
+    stream_buf *buf;
+    ssize_t bytes;
+    int iovcnt = 0;
+    int error;
+
+    for (buf = stream->out.head; buf && iovcnt < STREAM_MAX_IOV; buf = buf->next) {
+        iov[iovcnt].iov_base = buf->data + buf->start;
+        iov[iovcnt++].iov_len = buf->end - buf->start;
+    }
+
+    do {
+        bytes = writev(verto_get_fd(stream->ev), iov, iovcnt);
+    } while (bytes < 0 && errno == EINTR);
+
+    if (bytes < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+
+        /* The output can't go anywhere: drop it, or the fd stays writable
+         * and the error is reported again on every iteration */
+        error = errno;
+        stream->broken = 1;
+        queue_clear(&stream->out);
+        set_write_interest(stream, 0);
+        return error;
+    }
+
+    queue_drop(stream, &stream->out, bytes);
+    if (stream->out.len == 0)
+        set_write_interest(stream, 0);
+    return 0;
+}
+
+static void
+stream_callback(verto_ctx *ctx, verto_ev *ev)
+{
+    verto_stream *stream = verto_get_private(ev);
+    verto_ev_flag state = verto_get_fd_state(ev);
+    size_t before = stream->in.len;
+    int error = 0;
+
+    (void) ctx;
+
+    if (state & VERTO_EV_FLAG_IO_WRITE && stream->out.len > 0)
+        error = stream_do_write(stream);
+
+    if (!error && state & (VERTO_EV_FLAG_IO_READ | VERTO_EV_FLAG_IO_ERROR)
+            && verto_get_flags(ev) & VERTO_EV_FLAG_IO_READ && !stream->eof) {
+        error = stream_do_read(stream);
+
+        /* Stop polling for input we will never get (level-triggered) */
+        if (error || stream->eof)
+            verto_set_flags(ev, verto_get_flags(ev) & ~VERTO_EV_FLAG_IO_READ);
+    }
+
+    if (error || stream->eof || stream->in.len != before)
+        stream->callback(stream, error);
+}
+
+static void
+stream_free(verto_ctx *ctx, verto_ev *ev)
+{
+    verto_stream *stream = verto_get_private(ev);
+
+    (void) ctx;
+
+    queue_clear(&stream->in);
+    queue_clear(&stream->out);
+    free(stream->spare);
+    free(stream);
+}
+
+verto_stream *
+verto_stream_new(verto_ctx *ctx, verto_ev_flag flags,
+                 verto_stream_callback *callback, int fd)
+{
+    verto_stream *stream;
+
+    if (!callback)
+        return NULL;
+
+    stream = malloc(sizeof(verto_stream));
+    if (!stream)
+        return NULL;
+    memset(stream, 0, sizeof(verto_stream));
+    stream->callback = callback;
+
+    flags &= VERTO_EV_FLAG_PRIORITY_LOW | VERTO_EV_FLAG_PRIORITY_MEDIUM
+             | VERTO_EV_FLAG_PRIORITY_HIGH | VERTO_EV_FLAG_REINITIABLE
+             | VERTO_EV_FLAG_IO_CLOSE_FD;
+    flags |= VERTO_EV_FLAG_PERSIST | VERTO_EV_FLAG_IO_READ;
+
+    stream->ev = verto_add_io(ctx, flags, stream_callback, fd);
+    if (!stream->ev) {
+        free(stream);
+        return NULL;
+    }
+
+    verto_set_private(stream->ev, stream, stream_free);
+    return stream;
+}
+
+void
+verto_stream_free(verto_stream *stream)
+{
+    if (!stream || stream->freed)
+        return;
+
+    stream->freed = 1;
+    verto_del(stream->ev);
+}
+
+verto_ev *
+verto_stream_get_ev(const verto_stream *stream)
+{
+    return stream->ev;
+}
+
+void
+verto_stream_set_private(verto_stream *stream, void *priv)
+{
+    if (stream)
+        stream->priv = priv;
+}
+
+void *
+verto_stream_get_private(const verto_stream *stream)
+{
+    return stream->priv;
+}
+
+int
+verto_stream_is_eof(const verto_stream *stream)
+{
+    return stream->eof;
+}
+
+size_t
+verto_stream_get_readable(const verto_stream *stream)
+{
+    return stream->in.len;
+}
+
+int
+verto_stream_peek(const verto_stream *stream, struct iovec *iov, int iovcnt)
+{
+    stream_buf *buf;
+    int i = 0;
+
+    for (buf = stream->in.head; buf && i < iovcnt; buf = buf->next) {
+        if (buf->end == buf->start)
+            continue;
+        iov[i].iov_base = buf->data + buf->start;
+        iov[i++].iov_len = buf->end - buf->start;
+    }
+
+    return i;
+}
+
+void
+verto_stream_consume(verto_stream *stream, size_t len)
+{
+    queue_drop(stream, &stream->in, len);
+}
+
+size_t
+verto_stream_read(verto_stream *stream, void *buf, size_t len)
+{
+    stream_buf *cur;
+    size_t copied = 0;
+
+    for (cur = stream->in.head; cur && copied < len; cur = cur->next) {
+        size_t n = cur->end - cur->start;
+
+        if (n > len - copied)
+            n = len - copied;
+        memcpy((char *) buf + copied, cur->data + cur->start, n);
+        copied += n;
+    }
+
+    queue_drop(stream, &stream->in, copied);
+    return copied;
+}
+
+static int
+stream_queue_out(verto_stream *stream, stream_buf *buf)
+{
+    int wasempty = stream->out.len == 0;
+
+    if (buf)
+        queue_push(&stream->out, buf);
+
+    /* Only touch the event when the queue stops being empty */
+    if (wasempty && stream->out.len > 0)
+        set_write_interest(stream, 1);
+    return 1;
+}
+
+int
+verto_stream_write(verto_stream *stream, const void *data, size_t len)
+{
+    stream_buf *tail, *buf;
+
+    if (!stream || stream->freed || stream->broken || (!data && len > 0))
+        return 0;
+
+    /* Coalesce into the space left in the last owned buffer */
+    tail = stream->out.tail;
+    if (tail && tail->size > tail->end && len <= tail->size - tail->end) {
+        memcpy(tail->data + tail->end, data, len);
+        tail->end += len;
+        stream->out.len += len;
+        return stream_queue_out(stream, NULL);
+    }
+
+    if (len == 0)
+        return 1;
+
+    buf = buf_new(len < STREAM_BUF_SIZE ? STREAM_BUF_SIZE : len);
+    if (!buf)
+        return 0;
+
+    memcpy(buf->data, data, len);
+    buf->end = len;
+    return stream_queue_out(stream, buf);
+}
+
+int
+verto_stream_write_ref(verto_stream *stream, const void *data, size_t len,
+                       void (*release)(void *data))
+{
+    stream_buf *buf;
+
+    if (!stream || stream->freed || stream->broken || !data)
+        return 0;
+
+    if (len == 0) {
+        if (release)
+            release((void *) data);
+        return 1;
+    }
+
+    buf = malloc(sizeof(stream_buf));
+    if (!buf)
+        return 0;
+
+    memset(buf, 0, sizeof(stream_buf));
+    buf->data = (char *) data;
+    buf->end = len;
+    buf->release = release;
+    return stream_queue_out(stream, buf);
+}
+
+size_t
+verto_stream_get_pending(const verto_stream *stream)
+{
+    return stream->out.len;
+}
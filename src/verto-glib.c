@@ -152,6 +152,12 @@ glib_ctx_run_once(verto_mod_ctx *ctx)
     g_main_context_iteration(ctx->context, TRUE);
 }
 
+static void
+glib_ctx_run_nowait(verto_mod_ctx *ctx)
+{
+    g_main_context_iteration(ctx->context, FALSE);
+}
+
 static gboolean
 break_callback(gpointer loop)
 {
@@ -216,6 +222,14 @@ glib_ctx_set_flags(verto_mod_ctx *ctx, const verto_ev *ev, verto_mod_ev *evpriv)
         g_source_set_priority(evpriv, G_PRIORITY_LOW);
 
     if (verto_get_type(ev) == VERTO_EV_TYPE_IO) {
+        /* The fd changed (verto_set_fd()), so re-register the GPollFD */
+        if (((GIOSource*) evpriv)->fd.fd != verto_get_fd(ev)) {
+            g_source_remove_poll(evpriv, &((GIOSource*) evpriv)->fd);
+            ((GIOSource*) evpriv)->fd.fd = verto_get_fd(ev);
+            ((GIOSource*) evpriv)->fd.revents = 0;
+            g_source_add_poll(evpriv, &((GIOSource*) evpriv)->fd);
+        }
+
         ((GIOSource*) evpriv)->fd.events = 0;
 
         if (verto_get_flags(ev) & VERTO_EV_FLAG_IO_READ)
@@ -312,6 +326,8 @@ glib_ctx_del(verto_mod_ctx *ctx, const verto_ev *ev, verto_mod_ev *evpriv)
 }
 
 #define glib_ctx_reinitialize NULL
+#define glib_ctx_drop NULL
+#define glib_ctx_reinitialize_all NULL
 VERTO_MODULE(glib, g_main_context_default, VERTO_GLIB_SUPPORTED_TYPES);
 
 verto_ctx *
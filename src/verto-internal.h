@@ -0,0 +1,155 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* The definitions of verto's core structures, shared by the core's
+ * translation units (and by the builtin module in direct mode, see
+ * verto.c).  Not installed: modules must keep to the accessors. */
+
+#ifndef VERTO_INTERNAL_H_
+#define VERTO_INTERNAL_H_
+
+#include <stddef.h>
+#include <time.h>
+
+#include <verto-module.h>
+#include "sigfd.h"
+
+typedef struct verto_arena verto_arena; /* See ev_alloc() in verto.c */
+typedef struct verto_watchdog verto_watchdog; /* See verto_set_watchdog() */
+typedef struct verto_rate verto_rate; /* See verto_set_io_rate() */
+
+typedef struct {
+    verto_defer_callback *callback;
+    void *arg;
+} verto_deferred;
+
+typedef struct {
+    verto_ev *ev;            /* NULL if free */
+    unsigned int generation; /* Changes whenever the slot is freed */
+    unsigned int next_free;  /* Index + 1 of the next free slot, or 0 */
+} verto_slot;
+
+struct verto_ctx {
+    size_t ref;
+    verto_mod_ctx *ctx;
+    const verto_module *module;
+    verto_ev *events;
+    verto_ev *ready;         /* Ready events carried over to the next */
+    verto_ev *ready_tail;    /* iteration because of the dispatch budget, */
+    size_t nready;           /* or triggered by verto_trigger() */
+    size_t budget;           /* Max. callbacks per iteration (0: no limit) */
+    unsigned long budget_usec; /* Max. time per iteration (0: no limit) */
+    size_t dispatched;       /* Callbacks fired in the current iteration */
+    struct timespec started; /* When the first of them was fired */
+    verto_deferred *deferred; /* Ring buffer of verto_defer() calls */
+    size_t defer_size;
+    size_t defer_head;
+    size_t defer_count;
+    unsigned int firing;     /* Callbacks on the stack */
+    int deflt;
+    int exit;
+    int looping;             /* Inside verto_run() */
+    int native;              /* Inside the module's ctx_run() */
+    int kicked;              /* ctx_run() was broken to go back to the core */
+    int introspect;          /* Stamp the callbacks (verto_set_introspection()) */
+    verto_ev *idles;         /* Emulated idle events, linked through ev */
+    sigfd_port *sigport;     /* Signal deliveries for this context */
+    verto_ev *sigfd_ev;      /* Watches the process-wide signalfd */
+    verto_ev *sigport_ev;    /* Watches sigport */
+    const verto_allocator *allocator; /* NULL: the process-wide one */
+    int hierarchical;        /* Allocate the events from arenas */
+    verto_arena *arena;      /* Event storage (hierarchical allocators) */
+    verto_ev *spare;         /* Released slots of the arena, through next */
+    verto_slot *slots;       /* The events by handle index */
+    size_t nslots;
+    unsigned int free_slot;  /* Index + 1 of the first free slot, or 0 */
+    verto_ev **fds;          /* The io events by fd, through fd_next */
+    size_t nfds;
+    verto_watchdog *watchdog; /* NULL unless verto_set_watchdog() */
+    unsigned long stalls;    /* Statistics, under the watchdog's mutex */
+    unsigned long longest_stall;
+    verto_ev *throttled;     /* Rate limited io events out of credit */
+    verto_ev *throttle_ev;   /* Resumes them */
+    struct timespec throttle_due;
+    verto_ev **scratch;      /* Events being fired (see scratch_take()) */
+    size_t scratch_size;
+    size_t scratch_used;
+};
+
+typedef struct {
+    verto_proc proc;
+    verto_proc_status status;
+} verto_child;
+
+typedef struct {
+    int fd;
+    verto_ev_flag state;
+} verto_io;
+
+typedef struct {
+    int signum;
+    unsigned int count;      /* Deliveries coalesced into this dispatch */
+} verto_signal;
+
+/* Keep everything verto_fire() touches on every dispatch (callback, priv,
+ * ev, ctx, the flags and the per-type option) at the front, so that it fits
+ * in a single 64-byte cache line.  Rarely used fields go at the end. */
+struct verto_ev {
+    verto_callback *callback;
+    void *priv;
+    verto_mod_ev *ev;
+    verto_ctx *ctx;
+    verto_ev_flag flags;
+    verto_ev_flag actual;
+    unsigned int type    : 8;  /* verto_ev_type */
+    unsigned int deleted : 1;
+    unsigned int queued  : 1;  /* On ctx->ready */
+    unsigned int emulated : 1; /* Provided by the core, not the module */
+    unsigned int internal : 1; /* Created by the core for its own use */
+    unsigned int rated   : 1;  /* Has a rate (verto_set_io_rate()) */
+    unsigned int depth   : 19; /* verto_fire() recursion depth */
+    unsigned int fires;        /* Callbacks run, for verto_dump() */
+    union {
+        verto_io io;
+        verto_signal signal;
+        time_t interval;
+        verto_child child;
+    } option;
+
+    /* Cold */
+    verto_ev *next;
+    verto_ev *prev;
+    verto_ev *fd_next;
+    unsigned int slot;
+    unsigned int fired;        /* FIRE_CLOCK ms of the last callback, or 0 */
+    verto_ev *ready_next;
+    verto_callback *onfree;
+    verto_rate *rate;          /* NULL unless verto_set_io_rate() */
+};
+
+/* Fails to compile if the hot part of struct verto_ev outgrows a line */
+typedef char verto_ev_hot_fields_fit_in_a_cache_line
+    [offsetof(verto_ev, next) <= 64 ? 1 : -1];
+
+#endif /* VERTO_INTERNAL_H_ */
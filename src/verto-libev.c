@@ -47,7 +47,7 @@ libev_ctx_default(void)
 static void
 libev_ctx_free(verto_mod_ctx *ctx)
 {
-    if (ctx != EV_DEFAULT)
+    if (!ev_is_default_loop(ctx))
         ev_loop_destroy(ctx);
 }
 
@@ -63,6 +63,12 @@ libev_ctx_run_once(verto_mod_ctx *ctx)
     ev_run(ctx, EVRUN_ONCE);
 }
 
+static void
+libev_ctx_run_nowait(verto_mod_ctx *ctx)
+{
+    ev_run(ctx, EVRUN_NOWAIT);
+}
+
 static void
 libev_ctx_break(verto_mod_ctx *ctx)
 {
@@ -75,6 +81,14 @@ libev_ctx_reinitialize(verto_mod_ctx *ctx)
     ev_loop_fork(ctx);
 }
 
+static int
+libev_ctx_reinitialize_all(verto_mod_ctx *ctx)
+{
+    /* The loop arms its active watchers again when it next runs */
+    ev_loop_fork(ctx);
+    return 1;
+}
+
 static void
 libev_callback(EV_P_ ev_watcher *w, int revents)
 {
@@ -99,30 +113,108 @@ libev_callback(EV_P_ ev_watcher *w, int revents)
     verto_fire(w->data);
 }
 
+static int
+libev_priority(const verto_ev *ev)
+{
+    if (verto_get_flags(ev) & VERTO_EV_FLAG_PRIORITY_HIGH)
+        return EV_MAXPRI;
+    if (verto_get_flags(ev) & VERTO_EV_FLAG_PRIORITY_MEDIUM)
+        return (EV_MINPRI + EV_MAXPRI) / 2;
+    if (verto_get_flags(ev) & VERTO_EV_FLAG_PRIORITY_LOW)
+        return EV_MINPRI;
+    return 0;
+}
+
+static int
+libev_io_events(const verto_ev *ev)
+{
+    int events = EV_NONE;
+
+    if (verto_get_flags(ev) & VERTO_EV_FLAG_IO_READ)
+        events |= EV_READ;
+    if (verto_get_flags(ev) & VERTO_EV_FLAG_IO_WRITE)
+        events |= EV_WRITE;
+    return events;
+}
+
+static void
+libev_start(verto_mod_ctx *ctx, const verto_ev *ev, ev_watcher *w)
+{
+    switch (verto_get_type(ev)) {
+        case VERTO_EV_TYPE_IO:
+            ev_io_start(ctx, (ev_io*) w);
+            break;
+        case VERTO_EV_TYPE_TIMEOUT:
+            ev_timer_start(ctx, (ev_timer*) w);
+            break;
+        case VERTO_EV_TYPE_IDLE:
+            ev_idle_start(ctx, (ev_idle*) w);
+            break;
+        case VERTO_EV_TYPE_SIGNAL:
+            ev_signal_start(ctx, (ev_signal*) w);
+            break;
+        case VERTO_EV_TYPE_CHILD:
+            ev_child_start(ctx, (ev_child*) w);
+            break;
+        default:
+            break;
+    }
+}
+
+static void
+libev_stop(verto_mod_ctx *ctx, const verto_ev *ev, ev_watcher *w)
+{
+    switch (verto_get_type(ev)) {
+        case VERTO_EV_TYPE_IO:
+            ev_io_stop(ctx, (ev_io*) w);
+            break;
+        case VERTO_EV_TYPE_TIMEOUT:
+            ev_timer_stop(ctx, (ev_timer*) w);
+            break;
+        case VERTO_EV_TYPE_IDLE:
+            ev_idle_stop(ctx, (ev_idle*) w);
+            break;
+        case VERTO_EV_TYPE_SIGNAL:
+            ev_signal_stop(ctx, (ev_signal*) w);
+            break;
+        case VERTO_EV_TYPE_CHILD:
+            ev_child_stop(ctx, (ev_child*) w);
+            break;
+        default:
+            break;
+    }
+}
+
 static void
 libev_ctx_set_flags(verto_mod_ctx *ctx, const verto_ev *ev,
                     verto_mod_ev *evpriv)
 {
-    if (verto_get_type(ev) == VERTO_EV_TYPE_IO) {
-        int events = EV_NONE;
+    int priority = libev_priority(ev);
+    int revents;
 
-        if (verto_get_flags(ev) & VERTO_EV_FLAG_IO_READ)
-            events |= EV_READ;
-        if (verto_get_flags(ev) & VERTO_EV_FLAG_IO_WRITE)
-            events |= EV_WRITE;
+    if (verto_get_type(ev) != VERTO_EV_TYPE_IO && ev_priority(evpriv) == priority)
+        return;
 
-        ev_io_stop(ctx, (ev_io*) evpriv);
-        ev_io_set(((ev_io*) evpriv), verto_get_fd(ev), events);
-        ev_io_start(ctx, (ev_io*) evpriv);
-    }
+    /* Both the priority and the io fd/events may only be changed while the
+     * watcher is stopped.  Stopping it also drops a pending event, so save
+     * it and feed it back afterwards.  Stopping and restarting a timer
+     * keeps its remaining time. */
+    revents = ev_clear_pending(ctx, evpriv);
+    libev_stop(ctx, ev, evpriv);
+
+    ev_set_priority(evpriv, priority);
+    if (verto_get_type(ev) == VERTO_EV_TYPE_IO)
+        ev_io_set(((ev_io*) evpriv), verto_get_fd(ev), libev_io_events(ev));
+
+    libev_start(ctx, ev, evpriv);
+    if (revents)
+        ev_feed_event(ctx, evpriv, revents);
 }
 
 #define setuptype(type, ...) \
     w.type = malloc(sizeof(ev_ ## type)); \
-    if (w.type) { \
+    if (w.type) \
     	ev_ ## type ## _init(w.type, (EV_CB(type, (*))) __VA_ARGS__); \
-    	ev_ ## type ## _start(ctx, w.type); \
-    } \
     break
 
 static verto_mod_ev *
@@ -142,7 +234,8 @@ libev_ctx_add(verto_mod_ctx *ctx, const verto_ev *ev, verto_ev_flag *flags)
     *flags |= VERTO_EV_FLAG_PERSIST;
     switch (verto_get_type(ev)) {
         case VERTO_EV_TYPE_IO:
-            setuptype(io, libev_callback, verto_get_fd(ev), EV_NONE);
+            setuptype(io, libev_callback, verto_get_fd(ev),
+                      libev_io_events(ev));
         case VERTO_EV_TYPE_TIMEOUT:
             interval = ((ev_tstamp) verto_get_interval(ev)) / 1000.0;
             setuptype(timer, libev_callback, interval, interval);
@@ -159,7 +252,8 @@ libev_ctx_add(verto_mod_ctx *ctx, const verto_ev *ev, verto_ev_flag *flags)
 
     if (w.watcher) {
         w.watcher->data = (void*) ev;
-        libev_ctx_set_flags(ctx, ev, w.watcher);
+        ev_set_priority(w.watcher, libev_priority(ev));
+        libev_start(ctx, ev, w.watcher);
     }
     return w.watcher;
 }
@@ -167,26 +261,20 @@ libev_ctx_add(verto_mod_ctx *ctx, const verto_ev *ev, verto_ev_flag *flags)
 static void
 libev_ctx_del(verto_mod_ctx *ctx, const verto_ev *ev, verto_mod_ev *evpriv)
 {
-    switch (verto_get_type(ev)) {
-        case VERTO_EV_TYPE_IO:
-            ev_io_stop(ctx, (ev_io*) evpriv);
-            break;
-        case VERTO_EV_TYPE_TIMEOUT:
-            ev_timer_stop(ctx, (ev_timer*) evpriv);
-            break;
-        case VERTO_EV_TYPE_IDLE:
-            ev_idle_stop(ctx, (ev_idle*) evpriv);
-            break;
-        case VERTO_EV_TYPE_SIGNAL:
-            ev_signal_stop(ctx, (ev_signal*) evpriv);
-            break;
-        case VERTO_EV_TYPE_CHILD:
-            ev_child_stop(ctx, (ev_child*) evpriv);
-            break;
-        default:
-            break;
-    }
+    libev_stop(ctx, ev, evpriv);
+    free(evpriv);
+}
 
+static void
+libev_ctx_drop(verto_mod_ctx *ctx, const verto_ev *ev, verto_mod_ev *evpriv)
+{
+    /* ev_loop_destroy() forgets the loop's watchers, except for signals
+     * which are registered process-wide; the default loop lives on.  Don't
+     * use EV_DEFAULT here, which would create the default loop (and its
+     * SIGCHLD handler) just to compare it. */
+    if (ev_is_default_loop(ctx) || verto_get_type(ev) == VERTO_EV_TYPE_SIGNAL
+            || verto_get_type(ev) == VERTO_EV_TYPE_CHILD)
+        libev_stop(ctx, ev, evpriv);
     free(evpriv);
 }
 
@@ -77,6 +77,12 @@ libevent_ctx_run_once(verto_mod_ctx *ctx)
     event_base_loop(ctx, EVLOOP_ONCE);
 }
 
+static void
+libevent_ctx_run_nowait(verto_mod_ctx *ctx)
+{
+    event_base_loop(ctx, EVLOOP_NONBLOCK);
+}
+
 static void
 libevent_ctx_break(verto_mod_ctx *ctx)
 {
@@ -89,6 +95,13 @@ libevent_ctx_reinitialize(verto_mod_ctx *ctx)
     event_reinit(ctx);
 }
 
+static int
+libevent_ctx_reinitialize_all(verto_mod_ctx *ctx)
+{
+    /* Adds the pending events to the new backend */
+    return event_reinit(ctx) == 0;
+}
+
 static void
 libevent_callback(evutil_socket_t socket, short type, void *data)
 {
@@ -109,15 +122,14 @@ libevent_callback(evutil_socket_t socket, short type, void *data)
     verto_fire(data);
 }
 
-static verto_mod_ev *
-libevent_ctx_add(verto_mod_ctx *ctx, const verto_ev *ev, verto_ev_flag *flags)
+static int
+libevent_assign(verto_mod_ctx *ctx, const verto_ev *ev, struct event *priv)
 {
-    struct event *priv = NULL;
     struct timeval *timeout = NULL;
     struct timeval tv;
+    evutil_socket_t fd = -1;
     int libeventflags = 0;
 
-    *flags |= verto_get_flags(ev) & VERTO_EV_FLAG_PERSIST;
     if (verto_get_flags(ev) & VERTO_EV_FLAG_PERSIST)
         libeventflags |= EV_PERSIST;
 
@@ -127,29 +139,27 @@ libevent_ctx_add(verto_mod_ctx *ctx, const verto_ev *ev, verto_ev_flag *flags)
             libeventflags |= EV_READ;
         if (verto_get_flags(ev) & VERTO_EV_FLAG_IO_WRITE)
             libeventflags |= EV_WRITE;
-        priv = event_new(ctx, verto_get_fd(ev), libeventflags,
-                         libevent_callback, (void *) ev);
+        fd = verto_get_fd(ev);
         break;
     case VERTO_EV_TYPE_TIMEOUT:
         timeout = &tv;
         tv.tv_sec = verto_get_interval(ev) / 1000;
         tv.tv_usec = verto_get_interval(ev) % 1000 * 1000;
-        priv = event_new(ctx, -1, EV_TIMEOUT | libeventflags,
-                         libevent_callback, (void *) ev);
+        libeventflags |= EV_TIMEOUT;
         break;
     case VERTO_EV_TYPE_SIGNAL:
-        priv = event_new(ctx, verto_get_signal(ev),
-                         EV_SIGNAL | libeventflags,
-                         libevent_callback, (void *) ev);
+        fd = verto_get_signal(ev);
+        libeventflags |= EV_SIGNAL;
         break;
     case VERTO_EV_TYPE_IDLE:
     case VERTO_EV_TYPE_CHILD:
     default:
-        return NULL; /* Not supported */
+        return 0; /* Not supported */
     }
 
-    if (!priv)
-        return NULL;
+    if (event_assign(priv, ctx, fd, libeventflags,
+                     libevent_callback, (void *) ev) != 0)
+        return 0;
 
     if (verto_get_flags(ev) & VERTO_EV_FLAG_PRIORITY_HIGH)
         event_priority_set(priv, 0);
@@ -158,7 +168,35 @@ libevent_ctx_add(verto_mod_ctx *ctx, const verto_ev *ev, verto_ev_flag *flags)
     else if (verto_get_flags(ev) & VERTO_EV_FLAG_PRIORITY_LOW)
         event_priority_set(priv, 2);
 
-    event_add(priv, timeout);
+    return event_add(priv, timeout) == 0;
+}
+
+static void
+libevent_ctx_set_flags(verto_mod_ctx *ctx, const verto_ev *ev,
+                       verto_mod_ev *evpriv)
+{
+    /* event_assign() may only be called on an event which is not pending,
+     * but it lets us reuse the allocation (and rebind the fd). */
+    event_del(evpriv);
+    libevent_assign(ctx, ev, evpriv);
+}
+
+static verto_mod_ev *
+libevent_ctx_add(verto_mod_ctx *ctx, const verto_ev *ev, verto_ev_flag *flags)
+{
+    struct event *priv = NULL;
+
+    *flags |= verto_get_flags(ev) & VERTO_EV_FLAG_PERSIST;
+
+    priv = event_new(ctx, -1, 0, libevent_callback, (void *) ev);
+    if (!priv)
+        return NULL;
+
+    if (!libevent_assign(ctx, ev, priv)) {
+        event_free(priv);
+        return NULL;
+    }
+
     return priv;
 }
 
@@ -172,7 +210,8 @@ libevent_ctx_del(verto_mod_ctx *ctx, const verto_ev *ev, verto_mod_ev *evpriv)
     event_free(evpriv);
 }
 
-#define libevent_ctx_set_flags NULL
+/* event_base_free() still removes the events which are left */
+#define libevent_ctx_drop NULL
 VERTO_MODULE(libevent, event_base_init,
              VERTO_EV_TYPE_IO |
              VERTO_EV_TYPE_TIMEOUT |
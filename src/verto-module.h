@@ -35,10 +35,9 @@ typedef void verto_mod_ctx;
 typedef void verto_mod_ev;
 #endif
 
-#define VERTO_MODULE_VERSION 3
+#define VERTO_MODULE_VERSION 5
 #define VERTO_MODULE_TABLE(name) verto_module_table_ ## name
-#define VERTO_MODULE(name, symb, types) \
-    static verto_ctx_funcs name ## _funcs = { \
+#define VERTO_MODULE_FUNCS(name) { \
         name ## _ctx_new, \
         name ## _ctx_default, \
         name ## _ctx_free, \
@@ -48,8 +47,13 @@ typedef void verto_mod_ev;
         name ## _ctx_reinitialize, \
         name ## _ctx_set_flags, \
         name ## _ctx_add, \
-        name ## _ctx_del \
-    }; \
+        name ## _ctx_del, \
+        name ## _ctx_run_nowait, \
+        name ## _ctx_drop, \
+        name ## _ctx_reinitialize_all \
+    }
+#define VERTO_MODULE(name, symb, types) \
+    static verto_ctx_funcs name ## _funcs = VERTO_MODULE_FUNCS(name); \
     verto_module VERTO_MODULE_TABLE(name) = { \
         VERTO_MODULE_VERSION, \
         # name, \
@@ -85,6 +89,16 @@ typedef struct {
     /* Required */ void (*ctx_del)(verto_mod_ctx *ctx,
                                    const verto_ev *ev,
                                    verto_mod_ev *modev);
+    /* Optional */ void (*ctx_run_nowait)(verto_mod_ctx *ctx);
+    /* Optional: releases modev without unregistering it from ctx, as ctx is
+     * about to be freed with ctx_free(); replaces ctx_del in verto_free() */
+    /* Optional */ void (*ctx_drop)(verto_mod_ctx *ctx,
+                                    const verto_ev *ev,
+                                    verto_mod_ev *modev);
+    /* Optional: like ctx_reinitialize, but keeps the watchers of ctx and
+     * registers them again itself, returning 0 on failure; replaces ctx_del,
+     * ctx_reinitialize and ctx_add of each event in verto_reinitialize() */
+    /* Optional */ int (*ctx_reinitialize_all)(verto_mod_ctx *ctx);
 } verto_ctx_funcs;
 
 typedef struct {
@@ -28,17 +28,31 @@
 #include <signal.h>
 #include <assert.h>
 #include <stdarg.h>
+#include <stddef.h>
 
 #include <libgen.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <errno.h>
+
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+#ifndef WIN32
+#include <sys/wait.h>
+#endif
 
 #ifdef HAVE_PTHREAD
 #include <pthread.h>
 #endif
 
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
+
 #include <verto-module.h>
 #include "module.h"
+#include "verto-internal.h"
 
 #define  _str(s) # s
 #define __str(s) _str(s)
@@ -48,44 +62,13 @@
 /* Remove flags we can emulate */
 #define make_actual(flags) ((flags) & ~(VERTO_EV_FLAG_PERSIST|VERTO_EV_FLAG_IO_CLOSE_FD))
 
-struct verto_ctx {
-    size_t ref;
-    verto_mod_ctx *ctx;
-    const verto_module *module;
-    verto_ev *events;
-    int deflt;
-    int exit;
-};
-
-typedef struct {
-    verto_proc proc;
-    verto_proc_status status;
-} verto_child;
-
-typedef struct {
-    int fd;
-    verto_ev_flag state;
-} verto_io;
-
-struct verto_ev {
-    verto_ev *next;
-    verto_ctx *ctx;
-    verto_ev_type type;
-    verto_callback *callback;
-    verto_callback *onfree;
-    void *priv;
-    verto_mod_ev *ev;
-    verto_ev_flag flags;
-    verto_ev_flag actual;
-    size_t depth;
-    int deleted;
-    union {
-        verto_io io;
-        int signal;
-        time_t interval;
-        verto_child child;
-    } option;
-};
+/* Stamps the callbacks for verto_dump(), while introspection is enabled: a
+ * coarse clock is read from memory, without a system call */
+#ifdef CLOCK_MONOTONIC_COARSE
+#define FIRE_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define FIRE_CLOCK CLOCK_MONOTONIC
+#endif
 
 typedef struct module_record module_record;
 struct module_record {
@@ -97,23 +80,157 @@ struct module_record {
 };
 
 
-#ifdef BUILTIN_MODULE
+static module_record *loaded_modules;
+
+#if defined(BUILTIN_MODULE) || defined(BUILTIN_GLIB) \
+        || defined(BUILTIN_LIBEV) || defined(BUILTIN_LIBEVENT)
+#define STATIC_MODULES
 #define _MODTABLE(n) verto_module_table_ ## n
 #define MODTABLE(n) _MODTABLE(n)
 /*
- * This symbol can be used when embedding verto.c in a library along with a
+ * BUILTIN_MODULE can be used when embedding verto.c in a library along with a
  * built-in private module, to preload the module instead of dynamically
  * linking it in later.  Define to <modulename>.
+ *
+ * configure defines BUILTIN_GLIB, BUILTIN_LIBEV and BUILTIN_LIBEVENT for the
+ * modules it compiles into libverto alongside verto.c.
+ *
+ * Either way, only the modules in this table are available; nothing is
+ * dlopen()ed.  They are tried in order.
  */
+#ifdef BUILTIN_MODULE
 extern verto_module MODTABLE(BUILTIN_MODULE);
-static module_record builtin_record = {
-    NULL, &MODTABLE(BUILTIN_MODULE), NULL, "", NULL
+#endif
+#ifndef BUILTIN_DIRECT
+#ifdef BUILTIN_GLIB
+extern verto_module MODTABLE(glib);
+#endif
+#ifdef BUILTIN_LIBEV
+extern verto_module MODTABLE(libev);
+#endif
+#ifdef BUILTIN_LIBEVENT
+extern verto_module MODTABLE(libevent);
+#endif
+#endif /* BUILTIN_DIRECT */
+
+static const verto_module *builtin_modules[] = {
+#ifdef BUILTIN_MODULE
+    &MODTABLE(BUILTIN_MODULE),
+#endif
+#ifndef BUILTIN_DIRECT
+#ifdef BUILTIN_GLIB
+    &MODTABLE(glib),
+#endif
+#ifdef BUILTIN_LIBEV
+    &MODTABLE(libev),
+#endif
+#ifdef BUILTIN_LIBEVENT
+    &MODTABLE(libevent),
+#endif
+#endif /* BUILTIN_DIRECT */
+    NULL
 };
-static module_record *loaded_modules = &builtin_record;
+#endif /* STATIC_MODULES */
+
+static void fire(verto_ev *ev);
+static void watchdog_free(verto_ctx *ctx);
+static void set_fd_state(verto_ev *ev, verto_ev_flag state);
+static verto_ctx *convert_module(const verto_module *module, int deflt,
+                                 verto_mod_ctx *mctx,
+                                 const verto_allocator *allocator);
+
+#ifdef BUILTIN_DIRECT
+/*
+ * In direct mode (configure's builtin modules), the module's source is
+ * compiled as part of this file.  The core calls the module through a
+ * constant table, which the compiler turns into direct calls that it can
+ * inline, and the module reads the events through the macros below rather
+ * than through the exported accessors, which may be interposed and thus
+ * can't be inlined.  Only the builtin module can be used.
+ */
+#define EV(ev) ((verto_ev *) (ev))
+#define verto_get_type(ev)      ((verto_ev_type) EV(ev)->type)
+#define verto_get_flags(ev)     (EV(ev)->flags)
+#define verto_get_fd(ev)        (EV(ev)->option.io.fd)
+#define verto_get_interval(ev)  (EV(ev)->option.interval)
+#define verto_get_signal(ev)    (EV(ev)->option.signal.signum)
+#define verto_get_proc(ev)      (EV(ev)->option.child.proc)
+#define verto_set_proc_status(ev, st) (EV(ev)->option.child.status = (st))
+#define verto_set_fd_state(ev, state) set_fd_state(ev, state)
+#define verto_fire(ev) fire(ev)
+
+/* The module's own handle types: the core only sees void pointers, so its
+ * functions go in the table through casts, as they do across the dlopen()
+ * boundary in the modular build. */
+#define verto_mod_ctx builtin_mod_ctx
+#define verto_mod_ev builtin_mod_ev
+#undef VERTO_MODULE_FUNCS
+#define VERTO_MODULE_FUNCS(name) { \
+        (void *(*)()) name ## _ctx_new, \
+        (void *(*)()) name ## _ctx_default, \
+        (void (*)(void *)) name ## _ctx_free, \
+        (void (*)(void *)) name ## _ctx_run, \
+        (void (*)(void *)) name ## _ctx_run_once, \
+        (void (*)(void *)) name ## _ctx_break, \
+        (void (*)(void *)) name ## _ctx_reinitialize, \
+        (void (*)(void *, const verto_ev *, void *)) name ## _ctx_set_flags, \
+        (void *(*)(void *, const verto_ev *, verto_ev_flag *)) \
+            name ## _ctx_add, \
+        (void (*)(void *, const verto_ev *, void *)) name ## _ctx_del, \
+        (void (*)(void *)) name ## _ctx_run_nowait, \
+        (void (*)(void *, const verto_ev *, void *)) name ## _ctx_drop, \
+        (int (*)(void *)) name ## _ctx_reinitialize_all \
+    }
+
+#define BUILTIN_SOURCE(n) __str(verto-n.c)
+#include BUILTIN_SOURCE(BUILTIN_MODULE)
+
+#undef verto_mod_ctx
+#undef verto_mod_ev
+#undef EV
+#undef verto_get_type
+#undef verto_get_flags
+#undef verto_get_fd
+#undef verto_get_interval
+#undef verto_get_signal
+#undef verto_get_proc
+#undef verto_set_proc_status
+#undef verto_set_fd_state
+#undef verto_fire
+
+#define DIRECT_FUNCS(n) VERTO_MODULE_FUNCS(n)
+static const verto_ctx_funcs direct_funcs = DIRECT_FUNCS(BUILTIN_MODULE);
+#define MODFUNC(ctx, func) ((void) (ctx), direct_funcs.func)
 #else
-static module_record *loaded_modules;
+#define MODFUNC(ctx, func) ((ctx)->module->funcs->func)
+#endif /* BUILTIN_DIRECT */
+
+static int pidfd_support = -1;
+
+/* Types the core can provide whatever the module supports */
+static verto_ev_type
+emulated_types(void)
+{
+    verto_ev_type types = VERTO_EV_TYPE_IDLE | VERTO_EV_TYPE_USER;
+
+#ifdef HAVE_SIGFD
+    types |= VERTO_EV_TYPE_SIGNAL;
+#endif
+
+#ifdef SYS_pidfd_open
+    if (pidfd_support < 0) {
+        int fd = syscall(SYS_pidfd_open, getpid(), 0);
+        pidfd_support = fd >= 0;
+        if (fd >= 0)
+            close(fd);
+    }
+    if (pidfd_support)
+        types |= VERTO_EV_TYPE_CHILD;
 #endif
 
+    return types;
+}
+
 static void *(*resize_cb)(void *mem, size_t size);
 static int resize_cb_hierarchical;
 
@@ -171,7 +288,141 @@ vresize(void *mem, size_t size)
     return (*resize_cb)(mem, size);
 }
 
-#ifndef BUILTIN_MODULE
+/* Memory that belongs to a context comes from its own allocator, if any */
+static void *
+aresize(const verto_allocator *allocator, void *mem, size_t size)
+{
+    if (!allocator)
+        return vresize(mem, size);
+    return allocator->resize(allocator->data, mem, size);
+}
+
+#define ctx_vresize(ctx, mem, size) aresize((ctx)->allocator, mem, size)
+#define ctx_vfree(ctx, mem) aresize((ctx)->allocator, mem, 0)
+
+/* The builtin pool allocator: freed events are kept, up to POOL_MAX_SIZE
+ * of them per thread, for the next ones.  Every block starts with a header
+ * holding the size of the block, or the next block in the pool.  The pool
+ * of a thread is freed when it exits; without pthreads nothing is kept. */
+typedef union pool_block pool_block;
+union pool_block {
+    pool_block *next;
+    size_t size;
+    double align;
+};
+
+#define POOL_MAX_SIZE 256
+
+typedef struct {
+    pool_block *head;
+    size_t count;
+} pool_state;
+
+#ifdef HAVE_PTHREAD
+static pthread_key_t pool_key;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static int pool_keyed;
+
+static void
+pool_drain(void *data)
+{
+    pool_state *state = data;
+    pool_block *block;
+
+    while ((block = state->head)) {
+        state->head = block->next;
+        free(block);
+    }
+    free(state);
+}
+
+static void
+pool_key_create(void)
+{
+    pool_keyed = pthread_key_create(&pool_key, pool_drain) == 0;
+}
+
+/* The pool of the calling thread, created if needed */
+static pool_state *
+pool_get(void)
+{
+    pool_state *state;
+
+    pthread_once(&pool_once, pool_key_create);
+    if (!pool_keyed)
+        return NULL;
+
+    state = pthread_getspecific(pool_key);
+    if (!state) {
+        state = malloc(sizeof(pool_state));
+        if (!state)
+            return NULL;
+        memset(state, 0, sizeof(pool_state));
+        if (pthread_setspecific(pool_key, state) != 0) {
+            free(state);
+            return NULL;
+        }
+    }
+    return state;
+}
+
+/* The main thread's pool isn't freed by the key: verto_cleanup() does */
+static void
+pool_cleanup(void)
+{
+    pool_state *state;
+
+    if (!pool_keyed)
+        return;
+
+    state = pthread_getspecific(pool_key);
+    if (state) {
+        pthread_setspecific(pool_key, NULL);
+        pool_drain(state);
+    }
+}
+#else
+#define pool_get() ((pool_state *) NULL)
+#define pool_cleanup()
+#endif
+
+static void *
+pool_resize(void *data, void *mem, size_t size)
+{
+    pool_block *block = mem ? (pool_block *) mem - 1 : NULL;
+    pool_state *state;
+
+    (void) data;
+
+    if (size == 0) {
+        if (block && block->size == sizeof(verto_ev)
+                && (state = pool_get()) && state->count < POOL_MAX_SIZE) {
+            block->next = state->head;
+            state->head = block;
+            state->count++;
+        } else
+            free(block);
+        return NULL;
+    }
+
+    if (!block && size == sizeof(verto_ev)
+            && (state = pool_get()) && state->head) {
+        block = state->head;
+        state->head = block->next;
+        state->count--;
+    } else {
+        block = realloc(block, sizeof(pool_block) + size);
+        if (!block)
+            return NULL;
+    }
+
+    block->size = size;
+    return block + 1;
+}
+
+static const verto_allocator pool_allocator = { pool_resize, NULL, 0 };
+
+#ifndef STATIC_MODULES
 static char *
 string_aconcat(const char *first, const char *second, const char *third) {
     char *ret;
@@ -254,7 +505,8 @@ shouldload(void *symb, void *misc, char **err)
 
     /* Check to make sure that this module supports our required features */
     if (data->reqtypes != VERTO_EV_TYPE_NONE
-            && (table->types & data->reqtypes) != data->reqtypes) {
+            && ((table->types | emulated_types()) & data->reqtypes)
+               != data->reqtypes) {
         if (err)
             *err = strdup("Module does not support required features!");
         return 0;
@@ -371,13 +623,39 @@ do_load_dir(const char *dirname, const char *prefix, const char *suffix,
     closedir(dir);
     return *record != NULL;
 }
-#endif
+#else
+static int
+do_load_builtin(const verto_module *module, module_record **record)
+{
+    module_record **tmp;
+
+    /* verto_convert() may have registered it since the cache was checked */
+    mutex_lock(&loaded_modules_mutex);
+    for (tmp = &loaded_modules ; *tmp ; tmp = &(*tmp)->next) {
+        if ((*tmp)->module == module) {
+            *record = *tmp;
+            mutex_unlock(&loaded_modules_mutex);
+            return 1;
+        }
+    }
+
+    *tmp = *record = vresize(NULL, sizeof(module_record));
+    if (*record) {
+        memset(*record, 0, sizeof(module_record));
+        (*record)->module = module;
+    }
+    mutex_unlock(&loaded_modules_mutex);
+    return *record != NULL;
+}
+#endif /* STATIC_MODULES */
 
 static int
 load_module(const char *impl, verto_ev_type reqtypes, module_record **record)
 {
     int success = 0;
-#ifndef BUILTIN_MODULE
+#ifdef STATIC_MODULES
+    size_t i;
+#else
     char *prefix = NULL;
     char *suffix = NULL;
     char *tmp = NULL;
@@ -387,7 +665,8 @@ load_module(const char *impl, verto_ev_type reqtypes, module_record **record)
     mutex_lock(&loaded_modules_mutex);
     if (impl) {
         for (*record = loaded_modules ; *record ; *record = (*record)->next) {
-            if ((strchr(impl, '/') && !strcmp(impl, (*record)->filename))
+            if ((strchr(impl, '/') && (*record)->filename
+                    && !strcmp(impl, (*record)->filename))
                     || !strcmp(impl, (*record)->module->name)) {
                 mutex_unlock(&loaded_modules_mutex);
                 return 1;
@@ -396,7 +675,8 @@ load_module(const char *impl, verto_ev_type reqtypes, module_record **record)
     } else if (loaded_modules) {
         for (*record = loaded_modules ; *record ; *record = (*record)->next) {
             if (reqtypes == VERTO_EV_TYPE_NONE
-                    || ((*record)->module->types & reqtypes) == reqtypes) {
+                    || (((*record)->module->types | emulated_types())
+                        & reqtypes) == reqtypes) {
                 mutex_unlock(&loaded_modules_mutex);
                 return 1;
             }
@@ -404,7 +684,17 @@ load_module(const char *impl, verto_ev_type reqtypes, module_record **record)
     }
     mutex_unlock(&loaded_modules_mutex);
 
-#ifndef BUILTIN_MODULE
+#ifdef STATIC_MODULES
+    for (i = 0 ; builtin_modules[i] ; i++) {
+        if (impl ? !strcmp(impl, builtin_modules[i]->name)
+                 : reqtypes == VERTO_EV_TYPE_NONE
+                   || ((builtin_modules[i]->types | emulated_types())
+                       & reqtypes) == reqtypes) {
+            success = do_load_builtin(builtin_modules[i], record);
+            break;
+        }
+    }
+#else
     if (!module_get_filename_for_symbol(verto_convert_module, &prefix))
         return 0;
 
@@ -475,10 +765,84 @@ load_module(const char *impl, verto_ev_type reqtypes, module_record **record)
 
     free(suffix);
     free(prefix);
-#endif /* BUILTIN_MODULE */
+#endif /* STATIC_MODULES */
     return success;
 }
 
+/* With a hierarchical allocator, events are carved out of arenas owned by
+ * their context.  A released event goes on the context's spare list for
+ * reuse, and the memory only goes back to the allocator, an arena at a
+ * time, when the context is freed. */
+struct verto_arena {
+    verto_arena *next;
+    size_t size;             /* Slots in evs */
+    size_t used;
+    verto_ev evs[1];
+};
+
+#define ARENA_MIN_SIZE 32
+#define ARENA_MAX_SIZE 4096
+
+static verto_ev *
+ev_alloc(verto_ctx *ctx)
+{
+    verto_arena *arena = ctx->arena;
+    verto_ev *ev;
+    size_t size;
+
+    if (!ctx->hierarchical)
+        return ctx_vresize(ctx, NULL, sizeof(verto_ev));
+
+    if (ctx->spare) {
+        ev = ctx->spare;
+        ctx->spare = ev->next;
+        return ev;
+    }
+
+    /* Each arena is twice as large as the last one, up to a point */
+    if (!arena || arena->used == arena->size) {
+        size = arena ? arena->size * 2 : ARENA_MIN_SIZE;
+        if (size > ARENA_MAX_SIZE)
+            size = ARENA_MAX_SIZE;
+
+        arena = ctx_vresize(ctx, NULL, offsetof(verto_arena, evs)
+                                       + size * sizeof(verto_ev));
+        if (!arena)
+            return NULL;
+        arena->next = ctx->arena;
+        arena->size = size;
+        arena->used = 0;
+        ctx->arena = arena;
+    }
+
+    return &arena->evs[arena->used++];
+}
+
+static void
+ev_release(verto_ev *ev)
+{
+    if (!ev->ctx->hierarchical) {
+        ctx_vfree(ev->ctx, ev);
+        return;
+    }
+
+    ev->next = ev->ctx->spare;
+    ev->ctx->spare = ev;
+}
+
+static void
+arenas_free(verto_ctx *ctx)
+{
+    verto_arena *arena, *next;
+
+    for (arena = ctx->arena; arena; arena = next) {
+        next = arena->next;
+        ctx_vfree(ctx, arena);
+    }
+    ctx->arena = NULL;
+    ctx->spare = NULL;
+}
+
 static verto_ev *
 make_ev(verto_ctx *ctx, verto_callback *callback,
         verto_ev_type type, verto_ev_flag flags)
@@ -488,7 +852,7 @@ make_ev(verto_ctx *ctx, verto_callback *callback,
     if (!ctx || !callback)
         return NULL;
 
-    ev = vresize(NULL, sizeof(verto_ev));
+    ev = ev_alloc(ctx);
     if (ev) {
         memset(ev, 0, sizeof(verto_ev));
         ev->ctx        = ctx;
@@ -500,17 +864,109 @@ make_ev(verto_ctx *ctx, verto_callback *callback,
     return ev;
 }
 
+/* Every event has a slot in its context's table, so that handles can be
+ * checked in constant time: the generation of a slot changes whenever it
+ * is freed. */
+static int
+slot_alloc(verto_ev *ev)
+{
+    verto_ctx *ctx = ev->ctx;
+    verto_slot *slots;
+    size_t i, size;
+
+    if (!ctx->free_slot) {
+        size = ctx->nslots ? ctx->nslots * 2 : 64;
+        slots = ctx_vresize(ctx, ctx->slots, size * sizeof(verto_slot));
+        if (!slots)
+            return 0;
+
+        for (i = ctx->nslots; i < size; i++) {
+            slots[i].ev = NULL;
+            slots[i].generation = 1;
+            slots[i].next_free = i + 1 < size ? i + 2 : 0;
+        }
+        ctx->free_slot = ctx->nslots + 1;
+        ctx->slots = slots;
+        ctx->nslots = size;
+    }
+
+    ev->slot = ctx->free_slot - 1;
+    ctx->free_slot = ctx->slots[ev->slot].next_free;
+    ctx->slots[ev->slot].ev = ev;
+    return 1;
+}
+
 static void
-push_ev(verto_ctx *ctx, verto_ev *ev)
+slot_free(verto_ev *ev)
+{
+    verto_slot *slot = &ev->ctx->slots[ev->slot];
+
+    slot->ev = NULL;
+    if (++slot->generation == 0)
+        slot->generation = 1;
+    slot->next_free = ev->ctx->free_slot;
+    ev->ctx->free_slot = ev->slot + 1;
+}
+
+/* The io events are also indexed by fd */
+static int
+fd_index(verto_ev *ev)
+{
+    verto_ctx *ctx = ev->ctx;
+    size_t fd = ev->option.io.fd, size;
+    verto_ev **fds;
+
+    if (fd >= ctx->nfds) {
+        for (size = ctx->nfds ? ctx->nfds : 64; size <= fd; size *= 2)
+            continue;
+
+        fds = ctx_vresize(ctx, ctx->fds, size * sizeof(verto_ev *));
+        if (!fds)
+            return 0;
+
+        memset(fds + ctx->nfds, 0, (size - ctx->nfds) * sizeof(verto_ev *));
+        ctx->fds = fds;
+        ctx->nfds = size;
+    }
+
+    ev->fd_next = ctx->fds[fd];
+    ctx->fds[fd] = ev;
+    return 1;
+}
+
+static void
+fd_unindex(verto_ev *ev)
 {
-    verto_ev *tmp;
+    verto_ev **cur;
+
+    for (cur = &ev->ctx->fds[ev->option.io.fd]; *cur; cur = &(*cur)->fd_next) {
+        if (*cur == ev) {
+            *cur = ev->fd_next;
+            break;
+        }
+    }
+    ev->fd_next = NULL;
+}
 
+static int
+push_ev(verto_ctx *ctx, verto_ev *ev)
+{
     if (!ctx || !ev)
-        return;
+        return 0;
+
+    if (!slot_alloc(ev))
+        return 0;
+    if (ev->type == VERTO_EV_TYPE_IO && !fd_index(ev)) {
+        slot_free(ev);
+        return 0;
+    }
 
-    tmp = ctx->events;
+    ev->prev = NULL;
+    ev->next = ctx->events;
+    if (ev->next)
+        ev->next->prev = ev;
     ctx->events = ev;
-    ctx->events->next = tmp;
+    return 1;
 }
 
 static void
@@ -519,10 +975,16 @@ remove_ev(verto_ev **origin, verto_ev *item)
     if (!origin || !*origin || !item)
         return;
 
-    if (*origin == item)
-        *origin = (*origin)->next;
+    if (item->prev)
+        item->prev->next = item->next;
+    else if (*origin == item)
+        *origin = item->next;
     else
-        remove_ev(&((*origin)->next), item);
+        return;
+
+    if (item->next)
+        item->next->prev = item->prev;
+    item->next = item->prev = NULL;
 }
 
 static void
@@ -532,98 +994,1176 @@ signal_ignore(verto_ctx *ctx, verto_ev *ev)
     (void) ev;
 }
 
-verto_ctx *
-verto_new(const char *impl, verto_ev_type reqtypes)
+/* Gets the module's ctx_run() to return to verto_run(), when the core
+ * has to step in between iterations */
+static void
+kick(verto_ctx *ctx)
 {
-    module_record *mr = NULL;
-
-    if (!load_module(impl, reqtypes, &mr))
-        return NULL;
-
-    return verto_convert_module(mr->module, 0, NULL);
+    if (ctx->native && !ctx->kicked) {
+        ctx->kicked = 1;
+        MODFUNC(ctx, ctx_break)(ctx->ctx);
+    }
 }
 
-verto_ctx *
-verto_default(const char *impl, verto_ev_type reqtypes)
+/* Fires a set of events which a callback may delete: holds them all until
+ * we are done, so that verto_del() only marks them. */
+static void
+fire_all(verto_ev **evs, size_t n, unsigned int count)
 {
-    module_record *mr = NULL;
-
-    if (!load_module(impl, reqtypes, &mr))
-        return NULL;
+    verto_ev *cur;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        evs[i]->depth++;
+
+    for (i = 0; i < n; i++) {
+        cur = evs[i];
+        cur->depth--;
+        if (cur->deleted) {
+            if (cur->depth == 0)
+                verto_del(cur);
+            continue;
+        }
 
-    return verto_convert_module(mr->module, 1, NULL);
+        if (cur->type == VERTO_EV_TYPE_SIGNAL)
+            cur->option.signal.count += count;
+        fire(cur);
+    }
 }
 
-int
-verto_set_default(const char *impl, verto_ev_type reqtypes)
+/* Arrays of events to fire come from a buffer kept in the context, so that
+ * dispatching doesn't allocate once it is big enough.  Callers nest (a
+ * callback may run the loop), so they take and give back in LIFO order;
+ * the few which don't fit get their own array. */
+static verto_ev **
+scratch_take(verto_ctx *ctx, size_t n)
 {
-    module_record *mr;
+    verto_ev **evs;
+    size_t size;
 
-    mutex_lock(&loaded_modules_mutex);
-    if (loaded_modules || !impl) {
-        mutex_unlock(&loaded_modules_mutex);
-        return 0;
+    if (ctx->scratch_used == 0 && n > ctx->scratch_size) {
+        size = n > ctx->scratch_size * 2 ? n : ctx->scratch_size * 2;
+        evs = ctx_vresize(ctx, ctx->scratch, size * sizeof(verto_ev *));
+        if (!evs)
+            return NULL;
+        ctx->scratch = evs;
+        ctx->scratch_size = size;
     }
-    mutex_unlock(&loaded_modules_mutex);
 
-    return load_module(impl, reqtypes, &mr);
+    if (n > ctx->scratch_size - ctx->scratch_used)
+        return ctx_vresize(ctx, NULL, n * sizeof(verto_ev *));
+
+    evs = ctx->scratch + ctx->scratch_used;
+    ctx->scratch_used += n;
+    return evs;
 }
 
-int
-verto_set_allocator(void *(*resize)(void *mem, size_t size),
-                    int hierarchical)
+static void
+scratch_give(verto_ctx *ctx, verto_ev **evs, size_t n)
 {
-    if (resize_cb || !resize)
-        return 0;
-    resize_cb = resize;
-    resize_cb_hierarchical = hierarchical;
-    return 1;
+    if (ctx->scratch_used >= n
+            && evs == ctx->scratch + ctx->scratch_used - n)
+        ctx->scratch_used -= n;
+    else
+        ctx_vfree(ctx, evs);
 }
 
-void
-verto_free(verto_ctx *ctx)
+static void
+signal_fire(verto_ctx *ctx, int signum, unsigned int count)
 {
-    verto_ev *cur, *next;
+    verto_ev *cur, **evs;
+    size_t n = 0;
 
-    if (!ctx)
+    for (cur = ctx->events; cur; cur = cur->next) {
+        if (cur->emulated && cur->type == VERTO_EV_TYPE_SIGNAL
+                && cur->option.signal.signum == signum && !cur->deleted)
+            n++;
+    }
+    if (n == 0)
         return;
 
-    ctx->ref = ctx->ref > 0 ? ctx->ref - 1 : 0;
-    if (ctx->ref > 0)
+    evs = scratch_take(ctx, n);
+    if (!evs)
         return;
 
-    /* Cancel all pending events */
-    next = NULL;
-    for (cur = ctx->events; cur != NULL; cur = next) {
-        next = cur->next;
-        verto_del(cur);
+    n = 0;
+    for (cur = ctx->events; cur; cur = cur->next) {
+        if (cur->emulated && cur->type == VERTO_EV_TYPE_SIGNAL
+                && cur->option.signal.signum == signum && !cur->deleted)
+            evs[n++] = cur;
     }
-    ctx->events = NULL;
-
-    /* Free the private */
-    if (!ctx->deflt || !ctx->module->funcs->ctx_default)
-        ctx->module->funcs->ctx_free(ctx->ctx);
 
-    vfree(ctx);
+    fire_all(evs, n, count);
+    scratch_give(ctx, evs, n);
 }
 
-void
-verto_cleanup(void)
+/* Emulated idle events fire in a check phase, after an iteration of the
+ * module's loop which had nothing to dispatch */
+static void
+idle_fire(verto_ctx *ctx)
 {
-    module_record *record;
+    verto_ev *cur, **evs;
+    size_t n = 0;
 
-    mutex_lock(&loaded_modules_mutex);
+    for (cur = ctx->idles; cur; cur = (verto_ev *) cur->ev)
+        n++;
+    if (n == 0)
+        return;
+
+    evs = scratch_take(ctx, n);
+    if (!evs)
+        return;
+
+    n = 0;
+    for (cur = ctx->idles; cur; cur = (verto_ev *) cur->ev)
+        evs[n++] = cur;
+
+    fire_all(evs, n, 0);
+    scratch_give(ctx, evs, n);
+}
+
+static void
+idle_watch(verto_ev *ev)
+{
+    ev->ev = (verto_mod_ev *) ev->ctx->idles;
+    ev->ctx->idles = ev;
+    kick(ev->ctx);
+}
+
+static void
+idle_unwatch(verto_ev *ev)
+{
+    verto_ev **cur;
+
+    for (cur = &ev->ctx->idles; *cur; cur = (verto_ev **) &(*cur)->ev) {
+        if (*cur == ev) {
+            *cur = (verto_ev *) ev->ev;
+            break;
+        }
+    }
+    ev->ev = NULL;
+}
+
+static void
+signal_deliver(verto_ctx *ctx)
+{
+    unsigned int counts[NSIG];
+    int i;
+
+    if (!sigfd_port_take(ctx->sigport, counts))
+        return;
+
+    for (i = 1; i < NSIG; i++) {
+        if (counts[i] > 0)
+            signal_fire(ctx, i, counts[i]);
+    }
+}
+
+static void
+sigfd_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    sigfd_read(ctx->sigport);
+    signal_deliver(ctx);
+}
+
+static void
+sigport_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    signal_deliver(ctx);
+}
+
+static verto_ev *
+add_internal_io(verto_ctx *ctx, verto_callback *callback, int fd)
+{
+    verto_ev *ev;
+
+    ev = verto_add_io(ctx, VERTO_EV_FLAG_PERSIST | VERTO_EV_FLAG_IO_READ
+                           | VERTO_EV_FLAG_REINITIABLE, callback, fd);
+    if (ev)
+        ev->internal = 1;
+    return ev;
+}
+
+static void
+signal_port_free(verto_ctx *ctx)
+{
+    verto_del(ctx->sigfd_ev);
+    verto_del(ctx->sigport_ev);
+    sigfd_port_free(ctx->sigport);
+    ctx->sigfd_ev = NULL;
+    ctx->sigport_ev = NULL;
+    ctx->sigport = NULL;
+}
+
+/* Routes the signal through the process-wide signalfd, which works on
+ * every module and in every thread, rather than through the module */
+static int
+signal_watch(verto_ev *ev)
+{
+    verto_ctx *ctx = ev->ctx;
+
+    if (!ctx->sigport) {
+        ctx->sigport = sigfd_port_new();
+        if (!ctx->sigport)
+            return 0;
+
+        ctx->sigfd_ev = add_internal_io(ctx, sigfd_cb, sigfd_get_fd());
+        ctx->sigport_ev = add_internal_io(ctx, sigport_cb,
+                                          sigfd_port_get_fd(ctx->sigport));
+        if (!ctx->sigfd_ev || !ctx->sigport_ev) {
+            signal_port_free(ctx);
+            return 0;
+        }
+    }
+
+    return sigfd_port_watch(ctx->sigport, ev->option.signal.signum);
+}
+
+#ifdef SYS_pidfd_open
+static void
+pidfd_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    verto_ev *child = ev->priv;
+    int status = 0;
+    pid_t pid;
+
+    (void) ctx;
+    do {
+        pid = waitpid(child->option.child.proc, &status, WNOHANG);
+    } while (pid < 0 && errno == EINTR);
+    if (pid == 0)
+        return;
+
+    /* The pidfd has served its purpose, drop it before the child event
+     * fires (or is carried over to the next iteration) */
+    child->ev = NULL;
+    verto_del(ev);
+
+    child->option.child.status = status;
+    fire(child);
+}
+#endif
+
+/* Watches the child through a pidfd, which becomes readable when the
+ * process exits: reaping it costs O(1) instead of a SIGCHLD handler which
+ * has to look through all the children being watched.  The pidfd event
+ * is stored in ev->ev. */
+static int
+child_watch(verto_ev *ev)
+{
+#ifdef SYS_pidfd_open
+    verto_ev *pev;
+    int fd;
+
+    if (pidfd_support == 0)
+        return 0;
+
+    fd = syscall(SYS_pidfd_open, ev->option.child.proc, 0);
+    if (fd < 0)
+        return 0;
+
+    pev = verto_add_io(ev->ctx, VERTO_EV_FLAG_PERSIST | VERTO_EV_FLAG_IO_READ
+                                | VERTO_EV_FLAG_IO_CLOSE_FD
+                                | (ev->flags & (VERTO_EV_FLAG_REINITIABLE
+                                   | VERTO_EV_FLAG_PRIORITY_LOW
+                                   | VERTO_EV_FLAG_PRIORITY_MEDIUM
+                                   | VERTO_EV_FLAG_PRIORITY_HIGH)),
+                       pidfd_cb, fd);
+    if (!pev) {
+        close(fd);
+        return 0;
+    }
+
+    pev->internal = 1;
+    pev->priv = ev;
+    ev->ev = (verto_mod_ev *) pev;
+    return 1;
+#else
+    (void) ev;
+    return 0;
+#endif
+}
+
+/* Io events on the same fd share a single registration with the module: a
+ * carrier, which watches the union of their interests and fires each of
+ * them according to the state.  The first event on an fd is registered on
+ * its own; a carrier takes over when a second one comes along.  Members of
+ * a carrier are emulated, and their ev points to the carrier. */
+#define IO_INTEREST (VERTO_EV_FLAG_IO_READ | VERTO_EV_FLAG_IO_WRITE)
+
+static int backend_add(verto_ev *ev);
+static void backend_del(verto_ev *ev);
+
+static int
+is_member(const verto_ev *ev, const verto_ev *carrier)
+{
+    return ev->emulated && ev->ev == (const verto_mod_ev *) carrier;
+}
+
+/* Another io event which could share a registration with ev */
+static verto_ev *
+io_sibling(const verto_ev *ev)
+{
+    verto_ev *cur;
+
+    if ((size_t) ev->option.io.fd >= ev->ctx->nfds)
+        return NULL;
+
+    for (cur = ev->ctx->fds[ev->option.io.fd]; cur; cur = cur->fd_next) {
+        if (cur != ev && !cur->internal && !cur->deleted)
+            return cur;
+    }
+    return NULL;
+}
+
+/* The carrier's flags for those of its members, or'd together: all their
+ * interests, and the highest of their priorities */
+static verto_ev_flag
+carrier_flags(verto_ev_flag members)
+{
+    verto_ev_flag flags = VERTO_EV_FLAG_PERSIST | VERTO_EV_FLAG_REINITIABLE
+                          | (members & IO_INTEREST);
+
+    if (members & VERTO_EV_FLAG_PRIORITY_HIGH)
+        flags |= VERTO_EV_FLAG_PRIORITY_HIGH;
+    else if (members & VERTO_EV_FLAG_PRIORITY_MEDIUM)
+        flags |= VERTO_EV_FLAG_PRIORITY_MEDIUM;
+    else if (members & VERTO_EV_FLAG_PRIORITY_LOW)
+        flags |= VERTO_EV_FLAG_PRIORITY_LOW;
+    return flags;
+}
+
+/* Adjusts the carrier to its members (plus joining), or deletes it once
+ * they are all gone */
+static void
+carrier_update(verto_ev *carrier, verto_ev *joining)
+{
+    verto_ev_flag members = joining ? joining->flags : 0;
+    size_t n = joining ? 1 : 0;
+    verto_ev *cur;
+
+    for (cur = carrier->ctx->fds[carrier->option.io.fd]; cur;
+         cur = cur->fd_next) {
+        if (is_member(cur, carrier)) {
+            members |= cur->flags;
+            n++;
+        }
+    }
+
+    if (n == 0)
+        verto_del(carrier);
+    else
+        verto_set_flags(carrier, carrier_flags(members));
+}
+
+static void
+carrier_cb(verto_ctx *ctx, verto_ev *carrier)
+{
+    verto_ev_flag state = carrier->option.io.state, want;
+    verto_ev *cur, **evs;
+    size_t n = 0;
+
+    for (cur = ctx->fds[carrier->option.io.fd]; cur; cur = cur->fd_next) {
+        if (is_member(cur, carrier) && !cur->deleted
+                && (state & (cur->flags | VERTO_EV_FLAG_IO_ERROR)))
+            n++;
+    }
+    if (n == 0)
+        return;
+
+    evs = scratch_take(ctx, n);
+    if (!evs)
+        return;
+
+    n = 0;
+    for (cur = ctx->fds[carrier->option.io.fd]; cur; cur = cur->fd_next) {
+        want = cur->flags | VERTO_EV_FLAG_IO_ERROR;
+        if (is_member(cur, carrier) && !cur->deleted && (state & want)) {
+            cur->option.io.state = state & want;
+            evs[n++] = cur;
+        }
+    }
+
+    fire_all(evs, n, 0);
+    scratch_give(ctx, evs, n);
+}
+
+/* Makes ev a member of the carrier of its fd, creating it if the sibling
+ * is registered on its own.  Fails if they can't share one. */
+static int
+carrier_join(verto_ev *ev, verto_ev *sibling)
+{
+    verto_ctx *ctx = ev->ctx;
+    verto_ev *carrier;
+
+    if (sibling->emulated)
+        carrier = (verto_ev *) sibling->ev;
+    else {
+        /* Don't pull the watcher from under a running callback, nor from a
+         * module which closes the fd with it */
+        if (sibling->depth > 0
+                || (sibling->actual & VERTO_EV_FLAG_IO_CLOSE_FD))
+            return 0;
+
+        carrier = make_ev(ctx, carrier_cb, VERTO_EV_TYPE_IO,
+                          carrier_flags(ev->flags | sibling->flags));
+        if (!carrier)
+            return 0;
+        carrier->option.io.fd = ev->option.io.fd;
+        carrier->internal = 1;
+        if (!backend_add(carrier)) {
+            ev_release(carrier);
+            return 0;
+        }
+        if (!push_ev(ctx, carrier)) {
+            backend_del(carrier);
+            ev_release(carrier);
+            return 0;
+        }
+
+        /* The carrier takes over the sibling's registration */
+        MODFUNC(ctx, ctx_del)(ctx->ctx, sibling, sibling->ev);
+        sibling->ev = carrier;
+        sibling->emulated = 1;
+        sibling->actual = sibling->flags & ~VERTO_EV_FLAG_IO_CLOSE_FD;
+    }
+
+    carrier_update(carrier, ev);
+    ev->ev = carrier;
+    ev->emulated = 1;
+    ev->actual = ev->flags & ~VERTO_EV_FLAG_IO_CLOSE_FD;
+    return 1;
+}
+
+static void
+carrier_leave(verto_ev *ev)
+{
+    verto_ev *carrier = (verto_ev *) ev->ev;
+
+    ev->ev = NULL;
+    carrier_update(carrier, NULL);
+}
 
-    for (record = loaded_modules; record; record = record->next) {
+/* Registers the event with the module, unless the core provides it */
+static int
+backend_add(verto_ev *ev)
+{
+    verto_ev *sibling;
+
+    /* User events only ever go through ctx->ready */
+    if (ev->type == VERTO_EV_TYPE_USER) {
+        ev->emulated = 1;
+        ev->actual = ev->flags;
+        return 1;
+    }
+
+    if (ev->type == VERTO_EV_TYPE_IDLE
+            && !(ev->ctx->module->types & VERTO_EV_TYPE_IDLE)) {
+        idle_watch(ev);
+        ev->emulated = 1;
+        ev->actual = ev->flags;
+        return 1;
+    }
+
+    if ((ev->type == VERTO_EV_TYPE_SIGNAL && signal_watch(ev))
+            || (ev->type == VERTO_EV_TYPE_CHILD
+                && !(ev->ctx->module->types & VERTO_EV_TYPE_CHILD)
+                && child_watch(ev))) {
+        ev->emulated = 1;
+        ev->actual = ev->flags;
+        return 1;
+    }
+
+    if (ev->type == VERTO_EV_TYPE_IO && !ev->internal) {
+        sibling = io_sibling(ev);
+        if (sibling && carrier_join(ev, sibling))
+            return 1;
+    }
+
+    ev->actual = make_actual(ev->flags);
+    ev->ev = MODFUNC(ev->ctx, ctx_add)(ev->ctx->ctx, ev, &ev->actual);
+    return ev->ev != NULL;
+}
+
+static void
+backend_del(verto_ev *ev)
+{
+    if (!ev->emulated)
+        MODFUNC(ev->ctx, ctx_del)(ev->ctx->ctx, ev, ev->ev);
+    else if (ev->type == VERTO_EV_TYPE_SIGNAL)
+        sigfd_port_unwatch(ev->ctx->sigport, ev->option.signal.signum);
+    else if (ev->type == VERTO_EV_TYPE_CHILD && ev->ev)
+        verto_del((verto_ev *) ev->ev);
+    else if (ev->type == VERTO_EV_TYPE_IDLE)
+        idle_unwatch(ev);
+    else if (ev->type == VERTO_EV_TYPE_IO && ev->ev)
+        carrier_leave(ev);
+}
+
+verto_ctx *
+verto_new(const char *impl, verto_ev_type reqtypes)
+{
+    module_record *mr = NULL;
+
+    if (!load_module(impl, reqtypes, &mr))
+        return NULL;
+
+    return verto_convert_module(mr->module, 0, NULL);
+}
+
+verto_ctx *
+verto_new_with_allocator(const char *impl, verto_ev_type reqtypes,
+                         const verto_allocator *allocator)
+{
+    module_record *mr = NULL;
+
+    if (!load_module(impl, reqtypes, &mr))
+        return NULL;
+
+    return convert_module(mr->module, 0, NULL, allocator);
+}
+
+const verto_allocator *
+verto_thread_pool_allocator(void)
+{
+    return &pool_allocator;
+}
+
+verto_ctx *
+verto_default(const char *impl, verto_ev_type reqtypes)
+{
+    module_record *mr = NULL;
+
+    if (!load_module(impl, reqtypes, &mr))
+        return NULL;
+
+    return verto_convert_module(mr->module, 1, NULL);
+}
+
+int
+verto_set_default(const char *impl, verto_ev_type reqtypes)
+{
+    module_record *mr;
+
+    mutex_lock(&loaded_modules_mutex);
+    if (loaded_modules || !impl) {
+        mutex_unlock(&loaded_modules_mutex);
+        return 0;
+    }
+    mutex_unlock(&loaded_modules_mutex);
+
+    return load_module(impl, reqtypes, &mr);
+}
+
+int
+verto_set_allocator(void *(*resize)(void *mem, size_t size),
+                    int hierarchical)
+{
+    if (resize_cb || !resize)
+        return 0;
+    resize_cb = resize;
+    resize_cb_hierarchical = hierarchical;
+    return 1;
+}
+
+static void
+close_fd(verto_ev *ev)
+{
+    if ((ev->type == VERTO_EV_TYPE_IO) &&
+        (ev->flags & VERTO_EV_FLAG_IO_CLOSE_FD) &&
+        !(ev->actual & VERTO_EV_FLAG_IO_CLOSE_FD))
+        close(ev->option.io.fd);
+}
+
+/* Cancels and frees all the events of ctx in a single pass, where
+ * verto_del() would have to unlink them one at a time.  Every event is
+ * held first, so the onfree callbacks may verto_del() any of them.  If the
+ * module's loop is about to be freed, its watchers are dropped with it
+ * rather than unregistered one by one. */
+static void
+events_free(verto_ctx *ctx, int drop)
+{
+    verto_ev *done = NULL, *batch, *cur, *last = NULL;
+
+    ctx->ready = ctx->ready_tail = NULL;
+    ctx->nready = 0;
+
+    /* Onfree callbacks may add events: they make another batch */
+    while ((batch = ctx->events)) {
+        ctx->events = NULL;
+
+        for (cur = batch; cur; cur = cur->next)
+            cur->depth++;
+
+        for (cur = batch; cur; cur = cur->next) {
+            if (cur->onfree)
+                cur->onfree(ctx, cur);
+            if (cur->rate)
+                ctx_vfree(ctx, cur->rate);
+            if (cur->emulated && cur->type == VERTO_EV_TYPE_IO)
+                ; /* Goes with its carrier */
+            else if (drop && !cur->emulated && MODFUNC(ctx, ctx_drop))
+                MODFUNC(ctx, ctx_drop)(ctx->ctx, cur, cur->ev);
+            else
+                backend_del(cur);
+            close_fd(cur);
+
+            if (!cur->next) {
+                if (last)
+                    last->next = batch;
+                else
+                    done = batch;
+                last = cur;
+            }
+        }
+    }
+
+    /* The signal port's events and the throttle timer went with the
+     * others */
+    ctx->sigfd_ev = ctx->sigport_ev = NULL;
+    ctx->throttled = ctx->throttle_ev = NULL;
+    signal_port_free(ctx);
+
+    ctx_vfree(ctx, ctx->slots);
+    ctx_vfree(ctx, ctx->fds);
+    ctx->slots = NULL;
+    ctx->fds = NULL;
+
+    if (ctx->hierarchical) {
+        arenas_free(ctx);
+        return;
+    }
+
+    for (cur = done; cur; cur = batch) {
+        batch = cur->next;
+        ctx_vfree(ctx, cur);
+    }
+}
+
+void
+verto_free(verto_ctx *ctx)
+{
+    int destroy;
+
+    if (!ctx)
+        return;
+
+    ctx->ref = ctx->ref > 0 ? ctx->ref - 1 : 0;
+    if (ctx->ref > 0)
+        return;
+
+    if (ctx->watchdog)
+        watchdog_free(ctx);
+
+    /* Cancel all pending events */
+    destroy = !ctx->deflt || !MODFUNC(ctx, ctx_default);
+    events_free(ctx, destroy);
+
+    /* Work deferred by now won't happen */
+    ctx_vfree(ctx, ctx->deferred);
+    if (ctx->scratch)
+        ctx_vfree(ctx, ctx->scratch);
+
+    /* Free the private */
+    if (destroy)
+        MODFUNC(ctx, ctx_free)(ctx->ctx);
+
+    ctx_vfree(ctx, ctx);
+}
+
+void
+verto_cleanup(void)
+{
+    module_record *record, *next;
+
+    mutex_lock(&loaded_modules_mutex);
+
+    for (record = loaded_modules; record; record = next) {
+        next = record->next;
         module_close(record->dll);
         free(record->filename);
+        vfree(record);
     }
 
-    vfree(loaded_modules);
     loaded_modules = NULL;
 
     mutex_unlock(&loaded_modules_mutex);
     mutex_destroy(&loaded_modules_mutex);
+
+    sigfd_cleanup();
+    pool_cleanup();
+}
+
+int
+verto_defer(verto_ctx *ctx, verto_defer_callback *callback, void *arg)
+{
+    verto_deferred *tmp;
+    size_t size, tail, i;
+
+    if (!ctx || !callback)
+        return 0;
+
+    /* Grow by doubling, unwrapping the entries at the start of the new
+     * buffer so that head can go back to 0 */
+    if (ctx->defer_count == ctx->defer_size) {
+        size = ctx->defer_size ? ctx->defer_size * 2 : 16;
+        tmp = ctx_vresize(ctx, NULL, size * sizeof(verto_deferred));
+        if (!tmp)
+            return 0;
+
+        for (i = 0; i < ctx->defer_count; i++)
+            tmp[i] = ctx->deferred[(ctx->defer_head + i) % ctx->defer_size];
+
+        ctx_vfree(ctx, ctx->deferred);
+        ctx->deferred = tmp;
+        ctx->defer_size = size;
+        ctx->defer_head = 0;
+    }
+
+    tail = (ctx->defer_head + ctx->defer_count) % ctx->defer_size;
+    ctx->deferred[tail].callback = callback;
+    ctx->deferred[tail].arg = arg;
+    ctx->defer_count++;
+    return 1;
+}
+
+/* Runs the deferred work, including the work it defers itself */
+static void
+defer_drain(verto_ctx *ctx)
+{
+    verto_deferred item;
+
+    ctx->firing++;
+    while (ctx->defer_count > 0) {
+        item = ctx->deferred[ctx->defer_head];
+        ctx->defer_head = (ctx->defer_head + 1) % ctx->defer_size;
+        ctx->defer_count--;
+        item.callback(ctx, item.arg);
+    }
+    ctx->firing--;
+}
+
+static void
+ready_push(verto_ctx *ctx, verto_ev *ev)
+{
+    ev->queued = 1;
+    ev->ready_next = NULL;
+    ctx->nready++;
+    if (ctx->ready_tail)
+        ctx->ready_tail->ready_next = ev;
+    else
+        ctx->ready = ev;
+    ctx->ready_tail = ev;
+
+    /* The module's ctx_run() doesn't know about ctx->ready, so get it to
+     * return to verto_run() which will drain it. */
+    kick(ctx);
+}
+
+static void
+ready_remove(verto_ctx *ctx, verto_ev *ev)
+{
+    verto_ev **cur, *prev = NULL;
+
+    for (cur = &ctx->ready; *cur; prev = *cur, cur = &(*cur)->ready_next) {
+        if (*cur == ev) {
+            *cur = ev->ready_next;
+            if (ctx->ready_tail == ev)
+                ctx->ready_tail = prev;
+            ctx->nready--;
+            break;
+        }
+    }
+    ev->queued = 0;
+}
+
+static int
+budget_exhausted(verto_ctx *ctx)
+{
+    struct timespec now;
+    unsigned long usec;
+
+    if (ctx->budget > 0 && ctx->dispatched >= ctx->budget)
+        return 1;
+
+    if (ctx->budget_usec == 0 || ctx->dispatched == 0)
+        return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    usec = (now.tv_sec - ctx->started.tv_sec) * 1000000
+           + (now.tv_nsec - ctx->started.tv_nsec) / 1000;
+    return usec >= ctx->budget_usec;
+}
+
+static void dispatch(verto_ev *ev);
+
+static void
+drain_ready(verto_ctx *ctx)
+{
+    verto_ev *ev;
+    size_t n;
+
+    /* Events queued by these callbacks wait for the next iteration */
+    for (n = ctx->nready; n > 0 && (ev = ctx->ready); n--) {
+        if (budget_exhausted(ctx))
+            break;
+
+        ctx->ready = ev->ready_next;
+        if (!ctx->ready)
+            ctx->ready_tail = NULL;
+        ctx->nready--;
+        ev->queued = 0;
+        dispatch(ev);
+    }
+}
+
+static void
+run_nowait_expired(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+    (void) ev;
+}
+
+static unsigned long
+usec_since(const struct timespec *then)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - then->tv_sec) * 1000000
+           + (now.tv_nsec - then->tv_nsec) / 1000;
+}
+
+#ifdef HAVE_PTHREAD
+#define WATCHDOG_FRAMES 16
+
+/* The loop tells the watchdog thread when it leaves the poll to run
+ * callbacks, and which ones run; the thread checks every quarter of the
+ * budget how long ago it left. */
+struct verto_watchdog {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;     /* Signalled to stop the thread */
+    verto_ctx *ctx;
+    pid_t pid;               /* The process running the thread */
+    unsigned long usec;
+    verto_stall_callback *callback;
+    void *data;
+    int stop;
+    int busy;                /* Away from the poll since 'since' */
+    int reported;            /* The current stall was reported */
+    struct timespec since;
+    size_t depth;            /* Callbacks running, outermost first */
+    verto_callback *frames[WATCHDOG_FRAMES];
+};
+
+static void
+watchdog_enter(verto_ctx *ctx, verto_callback *callback)
+{
+    verto_watchdog *wd = ctx->watchdog;
+
+    mutex_lock(&wd->mutex);
+    if (!wd->busy) {
+        wd->busy = 1;
+        wd->reported = 0;
+        clock_gettime(CLOCK_MONOTONIC, &wd->since);
+    }
+    if (wd->depth < WATCHDOG_FRAMES)
+        wd->frames[wd->depth] = callback;
+    wd->depth++;
+    mutex_unlock(&wd->mutex);
+}
+
+static void
+watchdog_leave(verto_ctx *ctx)
+{
+    verto_watchdog *wd = ctx->watchdog;
+
+    /* The watchdog may have been replaced by the callback */
+    mutex_lock(&wd->mutex);
+    if (wd->depth > 0)
+        wd->depth--;
+    mutex_unlock(&wd->mutex);
+}
+
+/* The loop goes back to the poll, or returns to its caller */
+static void
+watchdog_poll(verto_ctx *ctx)
+{
+    verto_watchdog *wd = ctx->watchdog;
+    unsigned long usec;
+
+    mutex_lock(&wd->mutex);
+    if (wd->busy && wd->reported) {
+        usec = usec_since(&wd->since);
+        if (usec > ctx->longest_stall)
+            ctx->longest_stall = usec;
+    }
+    wd->busy = 0;
+    mutex_unlock(&wd->mutex);
+}
+
+static void
+watchdog_report(verto_ctx *ctx, const verto_stall *stall, void *data)
+{
+    size_t i;
+#ifdef HAVE_EXECINFO_H
+    void *addr;
+#endif
+
+    (void) ctx;
+    (void) data;
+
+    fprintf(stderr, "verto: loop stalled for %lu ms in %lu callback(s):\n",
+            stall->usec / 1000, (unsigned long) stall->depth);
+    for (i = stall->ncallbacks; i-- > 0; ) {
+#ifdef HAVE_EXECINFO_H
+        addr = (void *) (size_t) stall->callbacks[i];
+        backtrace_symbols_fd(&addr, 1, STDERR_FILENO);
+#else
+        fprintf(stderr, "%#lx\n", (unsigned long) stall->callbacks[i]);
+#endif
+    }
+}
+
+static void *
+watchdog_main(void *arg)
+{
+    verto_watchdog *wd = arg;
+    verto_callback *frames[WATCHDOG_FRAMES];
+    verto_stall stall;
+    struct timespec deadline;
+    unsigned long interval = wd->usec / 4 > 1000 ? wd->usec / 4 : 1000;
+
+    mutex_lock(&wd->mutex);
+    while (!wd->stop) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += interval / 1000000;
+        deadline.tv_nsec += (interval % 1000000) * 1000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&wd->cond, &wd->mutex, &deadline);
+
+        if (wd->stop || !wd->busy || wd->reported)
+            continue;
+        stall.usec = usec_since(&wd->since);
+        if (stall.usec < wd->usec)
+            continue;
+
+        wd->reported = 1;
+        wd->ctx->stalls++;
+        stall.depth = wd->depth;
+        stall.ncallbacks = wd->depth < WATCHDOG_FRAMES
+                               ? wd->depth : WATCHDOG_FRAMES;
+        memcpy(frames, wd->frames, stall.ncallbacks * sizeof(*frames));
+        stall.callbacks = frames;
+
+        /* Don't hold up the loop while reporting */
+        mutex_unlock(&wd->mutex);
+        wd->callback(wd->ctx, &stall, wd->data);
+        mutex_lock(&wd->mutex);
+    }
+    mutex_unlock(&wd->mutex);
+    return NULL;
+}
+
+static void
+watchdog_free(verto_ctx *ctx)
+{
+    verto_watchdog *wd = ctx->watchdog;
+
+    mutex_lock(&wd->mutex);
+    wd->stop = 1;
+    pthread_cond_signal(&wd->cond);
+    mutex_unlock(&wd->mutex);
+    pthread_join(wd->thread, NULL);
+
+    ctx->watchdog = NULL;
+    pthread_cond_destroy(&wd->cond);
+    mutex_destroy(&wd->mutex);
+    ctx_vfree(ctx, wd);
+}
+
+int
+verto_set_watchdog(verto_ctx *ctx, unsigned long usec,
+                   verto_stall_callback *callback, void *data)
+{
+    verto_watchdog *wd;
+    pthread_condattr_t attr;
+    sigset_t all, old;
+    int err;
+
+    if (!ctx)
+        return 0;
+
+    if (ctx->watchdog)
+        watchdog_free(ctx);
+    if (usec == 0)
+        return 1;
+
+    wd = ctx_vresize(ctx, NULL, sizeof(verto_watchdog));
+    if (!wd)
+        return 0;
+    memset(wd, 0, sizeof(verto_watchdog));
+    wd->ctx = ctx;
+    wd->pid = getpid();
+    wd->usec = usec;
+    wd->callback = callback ? callback : watchdog_report;
+    wd->data = data;
+
+    if (pthread_mutex_init(&wd->mutex, NULL) != 0) {
+        ctx_vfree(ctx, wd);
+        return 0;
+    }
+    if (pthread_condattr_init(&attr) != 0) {
+        mutex_destroy(&wd->mutex);
+        ctx_vfree(ctx, wd);
+        return 0;
+    }
+    err = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC)
+          || pthread_cond_init(&wd->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (err) {
+        mutex_destroy(&wd->mutex);
+        ctx_vfree(ctx, wd);
+        return 0;
+    }
+
+    /* Signals must stay blocked in the thread for signalfd to get them */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    err = pthread_create(&wd->thread, NULL, watchdog_main, wd);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+        pthread_cond_destroy(&wd->cond);
+        mutex_destroy(&wd->mutex);
+        ctx_vfree(ctx, wd);
+        return 0;
+    }
+
+    ctx->watchdog = wd;
+
+    /* ctx_run() doesn't tell the watchdog when it polls */
+    kick(ctx);
+    return 1;
+}
+
+/* Starts the watchdog over in a child process, which has no thread */
+static void
+watchdog_reinitialize(verto_ctx *ctx)
+{
+    verto_watchdog *wd = ctx->watchdog;
+
+    if (wd->pid == getpid())
+        return;
+
+    ctx->watchdog = NULL;
+    verto_set_watchdog(ctx, wd->usec, wd->callback, wd->data);
+    ctx_vfree(ctx, wd);
+}
+
+int
+verto_get_stats(verto_ctx *ctx, verto_stats *stats)
+{
+    if (!ctx || !stats)
+        return 0;
+
+    if (ctx->watchdog)
+        mutex_lock(&ctx->watchdog->mutex);
+    stats->stalls = ctx->stalls;
+    stats->longest_stall_usec = ctx->longest_stall;
+    if (ctx->watchdog)
+        mutex_unlock(&ctx->watchdog->mutex);
+    return 1;
+}
+#else /* HAVE_PTHREAD */
+static void
+watchdog_enter(verto_ctx *ctx, verto_callback *callback)
+{
+    (void) ctx;
+    (void) callback;
+}
+
+static void
+watchdog_leave(verto_ctx *ctx)
+{
+    (void) ctx;
+}
+
+static void
+watchdog_poll(verto_ctx *ctx)
+{
+    (void) ctx;
+}
+
+static void
+watchdog_free(verto_ctx *ctx)
+{
+    (void) ctx;
+}
+
+static void
+watchdog_reinitialize(verto_ctx *ctx)
+{
+    (void) ctx;
+}
+
+int
+verto_set_watchdog(verto_ctx *ctx, unsigned long usec,
+                   verto_stall_callback *callback, void *data)
+{
+    (void) callback;
+    (void) data;
+
+    return ctx && usec == 0;
+}
+
+int
+verto_get_stats(verto_ctx *ctx, verto_stats *stats)
+{
+    if (!ctx || !stats)
+        return 0;
+
+    stats->stalls = ctx->stalls;
+    stats->longest_stall_usec = ctx->longest_stall;
+    return 1;
+}
+#endif /* HAVE_PTHREAD */
+
+/* Runs a single iteration of the loop, carried over events first */
+static void
+run_iteration(verto_ctx *ctx, int block)
+{
+    ctx->dispatched = 0;
+    if (ctx->defer_count > 0)
+        defer_drain(ctx);
+    if (ctx->ready)
+        drain_ready(ctx);
+
+    if (ctx->watchdog)
+        watchdog_poll(ctx);
+    if (block && !ctx->ready && !ctx->idles)
+        MODFUNC(ctx, ctx_run_once)(ctx->ctx);
+    else if (MODFUNC(ctx, ctx_run_nowait))
+        MODFUNC(ctx, ctx_run_nowait)(ctx->ctx);
+    else {
+        /* Make sure the module has something ready, so it won't block */
+        verto_ev *ev = verto_add_timeout(ctx, VERTO_EV_FLAG_NONE,
+                                         run_nowait_expired, 0);
+        if (ev)
+            ev->internal = 1;
+        MODFUNC(ctx, ctx_run_once)(ctx->ctx);
+        verto_del(ev);
+    }
+
+    if (ctx->idles && ctx->dispatched == 0 && !ctx->ready)
+        idle_fire(ctx);
+    if (ctx->watchdog)
+        watchdog_poll(ctx);
 }
 
 void
@@ -632,13 +2172,55 @@ verto_run(verto_ctx *ctx)
     if (!ctx)
         return;
 
-    if (ctx->module->funcs->ctx_break && ctx->module->funcs->ctx_run)
-        ctx->module->funcs->ctx_run(ctx->ctx);
-    else {
-        while (!ctx->exit)
-            ctx->module->funcs->ctx_run_once(ctx->ctx);
-        ctx->exit = 0;
+    ctx->looping++;
+    while (!ctx->exit) {
+        /* Let the module run its own loop unless the core has to step in
+         * between iterations: to enforce a budget, drain ctx->ready, fire
+         * emulated idle events or keep the watchdog informed. */
+        if (MODFUNC(ctx, ctx_break) && MODFUNC(ctx, ctx_run)
+                && ctx->budget == 0 && ctx->budget_usec == 0 && !ctx->ready
+                && !ctx->idles && !ctx->watchdog) {
+            ctx->native = 1;
+            MODFUNC(ctx, ctx_run)(ctx->ctx);
+            ctx->native = 0;
+            if (!ctx->kicked)
+                break;
+            ctx->kicked = 0;
+            continue;
+        }
+
+        run_iteration(ctx, 1);
     }
+    ctx->exit = 0;
+    ctx->looping--;
+}
+
+static void
+run_for_expired(verto_ctx *ctx, verto_ev *ev)
+{
+    *((int *) verto_get_private(ev)) = 1;
+    verto_break(ctx);
+}
+
+void
+verto_run_for(verto_ctx *ctx, time_t timeout)
+{
+    verto_ev *ev;
+    int expired = 0;
+
+    if (!ctx)
+        return;
+
+    ev = verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, run_for_expired, timeout);
+    if (!ev)
+        return;
+    verto_set_private(ev, &expired, NULL);
+
+    verto_run(ctx);
+
+    /* We were stopped by verto_break() before the timeout fired */
+    if (!expired)
+        verto_del(ev);
 }
 
 void
@@ -646,7 +2228,30 @@ verto_run_once(verto_ctx *ctx)
 {
     if (!ctx)
         return;
-    ctx->module->funcs->ctx_run_once(ctx->ctx);
+    run_iteration(ctx, 1);
+}
+
+void
+verto_run_nowait(verto_ctx *ctx)
+{
+    if (!ctx)
+        return;
+    run_iteration(ctx, 0);
+}
+
+void
+verto_set_dispatch_budget(verto_ctx *ctx, size_t callbacks,
+                          unsigned long usec)
+{
+    if (!ctx)
+        return;
+
+    ctx->budget = callbacks;
+    ctx->budget_usec = usec;
+
+    /* ctx_run() can't enforce the budget, go back to verto_run() */
+    if (callbacks > 0 || usec > 0)
+        kick(ctx);
 }
 
 void
@@ -655,8 +2260,13 @@ verto_break(verto_ctx *ctx)
     if (!ctx)
         return;
 
-    if (ctx->module->funcs->ctx_break && ctx->module->funcs->ctx_run)
-        ctx->module->funcs->ctx_break(ctx->ctx);
+    if (ctx->native) {
+        ctx->kicked = 0;
+        MODFUNC(ctx, ctx_break)(ctx->ctx);
+    } else if (ctx->looping)
+        ctx->exit = 1;
+    else if (MODFUNC(ctx, ctx_break) && MODFUNC(ctx, ctx_run))
+        MODFUNC(ctx, ctx_break)(ctx->ctx);
     else
         ctx->exit = 1;
 }
@@ -664,42 +2274,56 @@ verto_break(verto_ctx *ctx)
 int
 verto_reinitialize(verto_ctx *ctx)
 {
-    verto_ev *next, *prev, *cur;
+    verto_ev *next, *cur;
     int error = 1;
 
     if (!ctx)
         return 0;
 
-    /* Delete all events, but keep around the forkable ev structs */
-    prev = NULL;
+    /* Delete the ones which don't survive; internal events go with their
+     * owner.  This comes first so that the carriers they leave are still
+     * registered. */
     for (cur = ctx->events; cur != NULL; cur = next) {
-        next = cur->next;
-
-        if (cur->flags & VERTO_EV_FLAG_REINITIABLE) {
-            ctx->module->funcs->ctx_del(ctx->ctx, cur, cur->ev);
-            prev = cur;
+        for (next = cur->next; next && next->internal; next = next->next)
             continue;
-        }
-
-        verto_del(cur);
-        if (prev)
-            prev->next = next;
-        if (cur == ctx->events)
-            ctx->events = next;
+        if (!(cur->flags & VERTO_EV_FLAG_REINITIABLE) && !cur->internal)
+            verto_del(cur);
     }
 
-    /* Reinit the loop */
-    if (ctx->module->funcs->ctx_reinitialize)
-        ctx->module->funcs->ctx_reinitialize(ctx->ctx);
+    /* Signals are delivered again, to this process, once the port has an
+     * eventfd of its own: its events see the new one under the same fd */
+    if (ctx->sigport && !sigfd_port_reinitialize(ctx->sigport))
+        error = 0;
 
-    /* Recreate events that were marked forkable */
-    for (cur = ctx->events; cur != NULL; cur = cur->next) {
-        cur->actual = make_actual(cur->flags);
-        cur->ev = ctx->module->funcs->ctx_add(ctx->ctx, cur, &cur->actual);
-        if (!cur->ev)
+    if (MODFUNC(ctx, ctx_reinitialize_all)) {
+        /* The module registers the survivors again in one go */
+        if (!MODFUNC(ctx, ctx_reinitialize_all)(ctx->ctx))
             error = 0;
+    } else {
+        /* Keep around the forkable ev structs */
+        for (cur = ctx->events; cur != NULL; cur = cur->next) {
+            if ((cur->flags & VERTO_EV_FLAG_REINITIABLE) && !cur->emulated)
+                MODFUNC(ctx, ctx_del)(ctx->ctx, cur, cur->ev);
+        }
+
+        /* Reinit the loop */
+        if (MODFUNC(ctx, ctx_reinitialize))
+            MODFUNC(ctx, ctx_reinitialize)(ctx->ctx);
+
+        /* Recreate events that were marked forkable */
+        for (cur = ctx->events; cur != NULL; cur = cur->next) {
+            if (cur->emulated)
+                continue;
+            cur->actual = make_actual(cur->flags);
+            cur->ev = MODFUNC(ctx, ctx_add)(ctx->ctx, cur, &cur->actual);
+            if (!cur->ev)
+                error = 0;
+        }
     }
 
+    if (ctx->watchdog)
+        watchdog_reinitialize(ctx);
+
     return error;
 }
 
@@ -707,13 +2331,15 @@ verto_reinitialize(verto_ctx *ctx)
     ev = make_ev(ctx, callback, type, flags); \
     if (ev) { \
         set; \
-        ev->actual = make_actual(ev->flags); \
-        ev->ev = ctx->module->funcs->ctx_add(ctx->ctx, ev, &ev->actual); \
-        if (!ev->ev) { \
-            vfree(ev); \
+        if (!backend_add(ev)) { \
+            ev_release(ev); \
+            return NULL; \
+        } \
+        if (!push_ev(ctx, ev)) { \
+            backend_del(ev); \
+            ev_release(ev); \
             return NULL; \
         } \
-        push_ev(ctx, ev); \
     }
 
 verto_ev *
@@ -764,10 +2390,27 @@ verto_add_signal(verto_ctx *ctx, verto_ev_flag flags,
         if (!(flags & VERTO_EV_FLAG_PERSIST))
             return NULL;
     }
-    doadd(ev, ev->option.signal = signal, VERTO_EV_TYPE_SIGNAL);
+    doadd(ev, ev->option.signal.signum = signal, VERTO_EV_TYPE_SIGNAL);
+    return ev;
+}
+
+verto_ev *
+verto_add_user(verto_ctx *ctx, verto_ev_flag flags,
+               verto_callback *callback)
+{
+    verto_ev *ev;
+    doadd(ev,, VERTO_EV_TYPE_USER);
     return ev;
 }
 
+void
+verto_trigger(verto_ev *ev)
+{
+    if (!ev || ev->type != VERTO_EV_TYPE_USER || ev->queued || ev->deleted)
+        return;
+    ready_push(ev->ctx, ev);
+}
+
 verto_ev *
 verto_add_child(verto_ctx *ctx, verto_ev_flag flags,
                 verto_callback *callback, verto_proc proc)
@@ -828,18 +2471,95 @@ verto_set_flags(verto_ev *ev, verto_ev_flag flags)
     ev->flags  &= ~_VERTO_EV_FLAG_MUTABLE_MASK;
     ev->flags  |= MUTABLE(flags);
 
+    if (ev->emulated) {
+        ev->actual = ev->flags;
+        if (ev->type == VERTO_EV_TYPE_IO) {
+            ev->actual &= ~VERTO_EV_FLAG_IO_CLOSE_FD;
+            if (ev->ev) /* Not stopped by verto_set_fd() */
+                carrier_update((verto_ev *) ev->ev, NULL);
+        }
+        return;
+    }
+
     /* If setting flags isn't supported, just rebuild the event */
-    if (!ev->ctx->module->funcs->ctx_set_flags) {
-        ev->ctx->module->funcs->ctx_del(ev->ctx->ctx, ev, ev->ev);
+    if (!MODFUNC(ev->ctx, ctx_set_flags)) {
+        MODFUNC(ev->ctx, ctx_del)(ev->ctx->ctx, ev, ev->ev);
         ev->actual = make_actual(ev->flags);
-        ev->ev = ev->ctx->module->funcs->ctx_add(ev->ctx->ctx, ev, &ev->actual);
+        ev->ev = MODFUNC(ev->ctx, ctx_add)(ev->ctx->ctx, ev, &ev->actual);
         assert(ev->ev); /* Here is the main reason why modules should */
         return;         /* implement set_flags(): we cannot fail gracefully. */
     }
 
     ev->actual &= ~_VERTO_EV_FLAG_MUTABLE_MASK;
     ev->actual |= MUTABLE(flags);
-    ev->ctx->module->funcs->ctx_set_flags(ev->ctx->ctx, ev, ev->ev);
+    MODFUNC(ev->ctx, ctx_set_flags)(ev->ctx->ctx, ev, ev->ev);
+}
+
+int
+verto_set_fd(verto_ev *ev, int fd)
+{
+    verto_mod_ev *modev;
+    int old;
+
+    if (!ev || ev->type != VERTO_EV_TYPE_IO || fd < 0)
+        return 0;
+
+    old = ev->option.io.fd;
+    if (old == fd)
+        return 1;
+
+    fd_unindex(ev);
+    ev->option.io.fd = fd;
+    if (!fd_index(ev)) {
+        ev->option.io.fd = old;
+        fd_index(ev);
+        return 0;
+    }
+    ev->option.io.state = VERTO_EV_FLAG_NONE;
+
+    /* Leave the carrier of the old fd, or join one on the new fd */
+    if (ev->emulated || io_sibling(ev)) {
+        backend_del(ev);
+        ev->emulated = 0;
+        if (!backend_add(ev)) {
+            fd_unindex(ev);
+            ev->option.io.fd = old;
+            fd_index(ev);
+            if (!backend_add(ev)) {
+                /* Stopped: registered nowhere, like a member without a
+                 * carrier, and out of the index so that no carrier picks
+                 * it up.  verto_set_fd() can bring it back. */
+                fd_unindex(ev);
+                ev->emulated = 1;
+                ev->ev = NULL;
+                ev->actual = ev->flags & ~VERTO_EV_FLAG_IO_CLOSE_FD;
+            }
+            return 0;
+        }
+    } else if (!MODFUNC(ev->ctx, ctx_set_flags)) {
+        /* Setting flags isn't supported, so rebuild the event.  Unlike
+         * verto_set_flags() we can fail here, so add before we delete. */
+        verto_ev_flag actual = make_actual(ev->flags);
+
+        modev = MODFUNC(ev->ctx, ctx_add)(ev->ctx->ctx, ev, &actual);
+        if (!modev) {
+            fd_unindex(ev);
+            ev->option.io.fd = old;
+            fd_index(ev);
+            return 0;
+        }
+
+        MODFUNC(ev->ctx, ctx_del)(ev->ctx->ctx, ev, ev->ev);
+        ev->actual = actual;
+        ev->ev = modev;
+    } else
+        MODFUNC(ev->ctx, ctx_set_flags)(ev->ctx->ctx, ev, ev->ev);
+
+    /* The event owns the old fd, so close it now that nothing watches it */
+    if (ev->flags & VERTO_EV_FLAG_IO_CLOSE_FD)
+        close(old);
+
+    return 1;
 }
 
 int
@@ -868,10 +2588,18 @@ int
 verto_get_signal(const verto_ev *ev)
 {
     if (ev && (ev->type == VERTO_EV_TYPE_SIGNAL))
-        return ev->option.signal;
+        return ev->option.signal.signum;
     return -1;
 }
 
+unsigned int
+verto_get_signal_count(const verto_ev *ev)
+{
+    if (ev && (ev->type == VERTO_EV_TYPE_SIGNAL))
+        return ev->option.signal.count;
+    return 0;
+}
+
 verto_proc
 verto_get_proc(const verto_ev *ev) {
     if (ev && ev->type == VERTO_EV_TYPE_CHILD)
@@ -891,6 +2619,436 @@ verto_get_ctx(const verto_ev *ev)
     return ev->ctx;
 }
 
+verto_handle
+verto_get_handle(const verto_ev *ev)
+{
+    verto_handle handle = { 0, 0 };
+
+    if (ev) {
+        handle.index = ev->slot;
+        handle.generation = ev->ctx->slots[ev->slot].generation;
+    }
+    return handle;
+}
+
+verto_ev *
+verto_find_handle(verto_ctx *ctx, verto_handle handle)
+{
+    verto_slot *slot;
+
+    if (!ctx || handle.index >= ctx->nslots)
+        return NULL;
+
+    slot = &ctx->slots[handle.index];
+    if (slot->generation != handle.generation || !slot->ev
+            || slot->ev->deleted)
+        return NULL;
+    return slot->ev;
+}
+
+verto_ev *
+verto_find_io(verto_ctx *ctx, int fd)
+{
+    verto_ev *ev;
+
+    if (!ctx || fd < 0 || (size_t) fd >= ctx->nfds)
+        return NULL;
+
+    for (ev = ctx->fds[fd]; ev; ev = ev->fd_next) {
+        if (!ev->internal && !ev->deleted)
+            return ev;
+    }
+    return NULL;
+}
+
+/* The read interest of a rate limited io event is suspended once it runs
+ * out of credit, which builds up with time.  The suspended events share a
+ * single internal timer, due when the first of them can fire again. */
+struct verto_rate {
+    unsigned long cost;      /* Credit taken by a callback (usec) */
+    unsigned long max;       /* Credit the bucket holds (usec) */
+    unsigned long credit;
+    struct timespec refilled;
+    int suspended;           /* On ctx->throttled */
+    verto_ev *next;          /* Next on ctx->throttled */
+};
+
+static void
+rate_refill(verto_rate *rate)
+{
+    unsigned long usec = usec_since(&rate->refilled);
+
+    clock_gettime(CLOCK_MONOTONIC, &rate->refilled);
+    if (usec >= rate->max - rate->credit)
+        rate->credit = rate->max;
+    else
+        rate->credit += usec;
+}
+
+static void throttle_cb(verto_ctx *ctx, verto_ev *ev);
+
+/* Makes sure the timer fires within usec */
+static void
+throttle_schedule(verto_ctx *ctx, unsigned long usec)
+{
+    struct timespec due;
+
+    clock_gettime(CLOCK_MONOTONIC, &due);
+    due.tv_sec += usec / 1000000;
+    due.tv_nsec += (usec % 1000000) * 1000;
+    if (due.tv_nsec >= 1000000000) {
+        due.tv_sec++;
+        due.tv_nsec -= 1000000000;
+    }
+
+    if (ctx->throttle_ev) {
+        if (ctx->throttle_due.tv_sec < due.tv_sec
+                || (ctx->throttle_due.tv_sec == due.tv_sec
+                    && ctx->throttle_due.tv_nsec <= due.tv_nsec))
+            return;
+        verto_del(ctx->throttle_ev);
+    }
+
+    ctx->throttle_ev = verto_add_timeout(ctx, VERTO_EV_FLAG_REINITIABLE,
+                                         throttle_cb, (usec + 999) / 1000);
+    if (ctx->throttle_ev)
+        ctx->throttle_ev->internal = 1;
+    ctx->throttle_due = due;
+}
+
+static void
+rate_suspend(verto_ev *ev)
+{
+    verto_rate *rate = ev->rate;
+
+    /* Even if suspended, verto_set_flags() may have brought it back */
+    verto_set_flags(ev, ev->flags & ~VERTO_EV_FLAG_IO_READ);
+    if (rate->suspended)
+        return;
+
+    rate->suspended = 1;
+    rate->next = ev->ctx->throttled;
+    ev->ctx->throttled = ev;
+    throttle_schedule(ev->ctx, rate->cost - rate->credit);
+}
+
+static void
+rate_unlink(verto_ev *ev)
+{
+    verto_ev **tmp;
+
+    for (tmp = &ev->ctx->throttled; *tmp; tmp = &(*tmp)->rate->next) {
+        if (*tmp == ev) {
+            *tmp = ev->rate->next;
+            break;
+        }
+    }
+    ev->rate->suspended = 0;
+
+    if (!ev->ctx->throttled && ev->ctx->throttle_ev) {
+        verto_del(ev->ctx->throttle_ev);
+        ev->ctx->throttle_ev = NULL;
+    }
+}
+
+static void
+throttle_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    verto_ev **tmp, *cur;
+    unsigned long wait = 0;
+
+    (void) ev;
+    ctx->throttle_ev = NULL;
+
+    for (tmp = &ctx->throttled; (cur = *tmp); ) {
+        rate_refill(cur->rate);
+        if (cur->rate->credit < cur->rate->cost) {
+            if (wait == 0 || cur->rate->cost - cur->rate->credit < wait)
+                wait = cur->rate->cost - cur->rate->credit;
+            tmp = &cur->rate->next;
+            continue;
+        }
+
+        *tmp = cur->rate->next;
+        cur->rate->suspended = 0;
+        verto_set_flags(cur, cur->flags | VERTO_EV_FLAG_IO_READ);
+    }
+
+    if (ctx->throttled)
+        throttle_schedule(ctx, wait);
+}
+
+/* Takes the credit for a read callback, or suspends the event */
+static int
+rate_take(verto_ev *ev)
+{
+    rate_refill(ev->rate);
+    if (ev->rate->credit < ev->rate->cost) {
+        rate_suspend(ev);
+        return 0;
+    }
+    ev->rate->credit -= ev->rate->cost;
+    return 1;
+}
+
+static void
+rate_free(verto_ev *ev)
+{
+    if (ev->rate->suspended)
+        rate_unlink(ev);
+    ctx_vfree(ev->ctx, ev->rate);
+    ev->rate = NULL;
+    ev->rated = 0;
+}
+
+int
+verto_set_io_rate(verto_ev *ev, unsigned int rate, unsigned int burst)
+{
+    if (!ev || ev->type != VERTO_EV_TYPE_IO)
+        return 0;
+
+    if (rate == 0) {
+        if (ev->rate && ev->rate->suspended)
+            verto_set_flags(ev, ev->flags | VERTO_EV_FLAG_IO_READ);
+        if (ev->rate)
+            rate_free(ev);
+        return 1;
+    }
+
+    if (!ev->rate) {
+        ev->rate = ctx_vresize(ev->ctx, NULL, sizeof(verto_rate));
+        if (!ev->rate)
+            return 0;
+        memset(ev->rate, 0, sizeof(verto_rate));
+        ev->rated = 1;
+    }
+
+    ev->rate->cost = rate < 1000000 ? 1000000 / rate : 1;
+    ev->rate->max = ev->rate->cost * (burst > 0 ? burst : 1);
+    ev->rate->credit = ev->rate->max;
+    clock_gettime(CLOCK_MONOTONIC, &ev->rate->refilled);
+    return 1;
+}
+
+size_t
+verto_foreach_event(verto_ctx *ctx, verto_visitor *visitor, void *data)
+{
+    verto_ev *cur, *next;
+    size_t count = 0;
+    int more = 1;
+
+    if (!ctx || !visitor)
+        return 0;
+
+    /* Hold each event while it is visited, so that the visitor can delete
+     * it.  Internal events, which can go with it, are never next. */
+    for (cur = ctx->events; cur && more; cur = next) {
+        if (!cur->internal && !cur->deleted) {
+            cur->depth++;
+            more = visitor(ctx, cur, data);
+            cur->depth--;
+            count++;
+        }
+
+        for (next = cur->next; next && next->internal; next = next->next)
+            continue;
+        if (cur->depth == 0 && cur->deleted)
+            verto_del(cur);
+    }
+
+    return count;
+}
+
+/* The FIRE_CLOCK in milliseconds, wrapping every 49 days; never 0, which
+ * means that the callback was not stamped */
+static unsigned int
+fire_stamp(void)
+{
+    struct timespec now;
+    unsigned int stamp;
+
+    clock_gettime(FIRE_CLOCK, &now);
+    stamp = (unsigned int) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    return stamp ? stamp : 1;
+}
+
+unsigned int
+verto_get_fire_count(const verto_ev *ev)
+{
+    return ev ? ev->fires : 0;
+}
+
+void
+verto_set_introspection(verto_ctx *ctx, int enable)
+{
+    if (ctx)
+        ctx->introspect = enable != 0;
+}
+
+long
+verto_get_time_since_fire(const verto_ev *ev)
+{
+    if (!ev || ev->fired == 0)
+        return -1;
+
+    /* Modulo 2^32 ms, so right across the wrap */
+    return (long) (unsigned int) (fire_stamp() - ev->fired);
+}
+
+typedef struct {
+    FILE *file;
+    verto_dump_format format;
+    size_t count;            /* Events written */
+} dump_state;
+
+static const struct {
+    verto_ev_flag flag;
+    const char *name;
+} flag_names[] = {
+    { VERTO_EV_FLAG_PERSIST, "persist" },
+    { VERTO_EV_FLAG_PRIORITY_LOW, "priority_low" },
+    { VERTO_EV_FLAG_PRIORITY_MEDIUM, "priority_medium" },
+    { VERTO_EV_FLAG_PRIORITY_HIGH, "priority_high" },
+    { VERTO_EV_FLAG_IO_READ, "io_read" },
+    { VERTO_EV_FLAG_IO_WRITE, "io_write" },
+    { VERTO_EV_FLAG_REINITIABLE, "reinitiable" },
+    { VERTO_EV_FLAG_IO_ERROR, "io_error" },
+    { VERTO_EV_FLAG_IO_CLOSE_FD, "io_close_fd" }
+};
+
+static const char *
+type_name(verto_ev_type type)
+{
+    switch (type) {
+        case VERTO_EV_TYPE_IO:
+            return "io";
+        case VERTO_EV_TYPE_TIMEOUT:
+            return "timeout";
+        case VERTO_EV_TYPE_IDLE:
+            return "idle";
+        case VERTO_EV_TYPE_SIGNAL:
+            return "signal";
+        case VERTO_EV_TYPE_CHILD:
+            return "child";
+        case VERTO_EV_TYPE_USER:
+            return "user";
+        default:
+            return "none";
+    }
+}
+
+/* Writes the names of flags as a JSON array, or separated by '|' */
+static void
+dump_flags(FILE *file, verto_dump_format format, verto_ev_flag flags)
+{
+    const char *sep = "";
+    size_t i;
+
+    if (format == VERTO_DUMP_JSON)
+        fputc('[', file);
+    for (i = 0; i < sizeof(flag_names) / sizeof(*flag_names); i++) {
+        if (!(flags & flag_names[i].flag))
+            continue;
+        if (format == VERTO_DUMP_JSON)
+            fprintf(file, "%s\"%s\"", sep, flag_names[i].name);
+        else
+            fprintf(file, "%s%s", sep, flag_names[i].name);
+        sep = format == VERTO_DUMP_JSON ? ", " : "|";
+    }
+    if (format == VERTO_DUMP_JSON)
+        fputc(']', file);
+    else if (*sep == '\0')
+        fputs("none", file);
+}
+
+static int
+dump_event(verto_ctx *ctx, verto_ev *ev, void *data)
+{
+    dump_state *state = data;
+    FILE *file = state->file;
+    int json = state->format == VERTO_DUMP_JSON;
+    const char *option = NULL;
+    long value = 0, since;
+
+    (void) ctx;
+
+    switch (ev->type) {
+        case VERTO_EV_TYPE_IO:
+            option = "fd";
+            value = ev->option.io.fd;
+            break;
+        case VERTO_EV_TYPE_TIMEOUT:
+            option = "interval";
+            value = (long) ev->option.interval;
+            break;
+        case VERTO_EV_TYPE_SIGNAL:
+            option = "signal";
+            value = ev->option.signal.signum;
+            break;
+        case VERTO_EV_TYPE_CHILD:
+            option = "pid";
+            value = (long) ev->option.child.proc;
+            break;
+        default:
+            break;
+    }
+
+    if (json) {
+        fprintf(file, "%s\n    {\"type\": \"%s\", \"callback\": \"%#lx\", "
+                "\"flags\": ", state->count++ ? "," : "", type_name(ev->type),
+                (unsigned long) ev->callback);
+    } else {
+        fprintf(file, "%s callback=%#lx flags=", type_name(ev->type),
+                (unsigned long) ev->callback);
+        state->count++;
+    }
+    dump_flags(file, state->format, ev->flags);
+    fputs(json ? ", \"actual\": " : " actual=", file);
+    dump_flags(file, state->format, ev->actual);
+    if (option)
+        fprintf(file, json ? ", \"%s\": %ld" : " %s=%ld", option, value);
+
+    since = verto_get_time_since_fire(ev);
+    if (json) {
+        fprintf(file, ", \"fires\": %u, \"since_fire_ms\": ", ev->fires);
+        if (since < 0)
+            fputs("null}", file);
+        else
+            fprintf(file, "%ld}", since);
+    } else {
+        fprintf(file, " fires=%u since_fire=", ev->fires);
+        if (since < 0)
+            fputs("never\n", file);
+        else
+            fprintf(file, "%ldms\n", since);
+    }
+
+    return !ferror(file);
+}
+
+int
+verto_dump(verto_ctx *ctx, FILE *file, verto_dump_format format)
+{
+    dump_state state;
+
+    if (!ctx || !file
+            || (format != VERTO_DUMP_JSON && format != VERTO_DUMP_TEXT))
+        return 0;
+
+    state.file = file;
+    state.format = format;
+    state.count = 0;
+
+    if (format == VERTO_DUMP_JSON)
+        fprintf(file, "{\"module\": \"%s\", \"events\": [",
+                ctx->module->name);
+    verto_foreach_event(ctx, dump_event, &state);
+    if (format == VERTO_DUMP_JSON)
+        fputs(state.count ? "\n]}\n" : "]}\n", file);
+
+    return !ferror(file) && fflush(file) == 0;
+}
+
 void
 verto_del(verto_ev *ev)
 {
@@ -906,29 +3064,39 @@ verto_del(verto_ev *ev)
         return;
     }
 
+    if (ev->queued)
+        ready_remove(ev->ctx, ev);
     if (ev->onfree)
         ev->onfree(ev->ctx, ev);
-    ev->ctx->module->funcs->ctx_del(ev->ctx->ctx, ev, ev->ev);
+    if (ev->rate)
+        rate_free(ev);
+    backend_del(ev);
     remove_ev(&(ev->ctx->events), ev);
+    slot_free(ev);
+    if (ev->type == VERTO_EV_TYPE_IO)
+        fd_unindex(ev);
 
-    if ((ev->type == VERTO_EV_TYPE_IO) &&
-        (ev->flags & VERTO_EV_FLAG_IO_CLOSE_FD) &&
-        !(ev->actual & VERTO_EV_FLAG_IO_CLOSE_FD))
-        close(ev->option.io.fd);
-
-    vfree(ev);
+    close_fd(ev);
+    ev_release(ev);
 }
 
 verto_ev_type
 verto_get_supported_types(verto_ctx *ctx)
+{
+    return ctx->module->types | emulated_types();
+}
+
+verto_ev_type
+verto_get_native_types(verto_ctx *ctx)
 {
     return ctx->module->types;
 }
 
 /*** THE FOLLOWING ARE FOR IMPLEMENTATION MODULES ONLY ***/
 
-verto_ctx *
-verto_convert_module(const verto_module *module, int deflt, verto_mod_ctx *mctx)
+static verto_ctx *
+convert_module(const verto_module *module, int deflt, verto_mod_ctx *mctx,
+               const verto_allocator *allocator)
 {
     verto_ctx *ctx = NULL;
     module_record *mr;
@@ -936,6 +3104,15 @@ verto_convert_module(const verto_module *module, int deflt, verto_mod_ctx *mctx)
     if (!module)
         return NULL;
 
+#ifdef BUILTIN_DIRECT
+    /* The core only knows how to call the builtin module */
+    if (module != &MODTABLE(BUILTIN_MODULE)) {
+        if (mctx)
+            module->funcs->ctx_free(mctx);
+        return NULL;
+    }
+#endif
+
     if (deflt) {
         mutex_lock(&loaded_modules_mutex);
         for (mr = loaded_modules ; mr ; mr = mr->next) {
@@ -962,7 +3139,7 @@ verto_convert_module(const verto_module *module, int deflt, verto_mod_ctx *mctx)
             goto error;
     }
 
-    ctx = vresize(NULL, sizeof(verto_ctx));
+    ctx = aresize(allocator, NULL, sizeof(verto_ctx));
     if (!ctx)
         goto error;
     memset(ctx, 0, sizeof(verto_ctx));
@@ -971,6 +3148,9 @@ verto_convert_module(const verto_module *module, int deflt, verto_mod_ctx *mctx)
     ctx->ctx = mctx;
     ctx->module = module;
     ctx->deflt = deflt;
+    ctx->allocator = allocator;
+    ctx->hierarchical = allocator ? allocator->hierarchical
+                                  : resize_cb_hierarchical;
 
     if (deflt) {
         module_record **tmp;
@@ -994,7 +3174,7 @@ verto_convert_module(const verto_module *module, int deflt, verto_mod_ctx *mctx)
 
         *tmp = vresize(NULL, sizeof(module_record));
         if (!*tmp) {
-            vfree(ctx);
+            ctx_vfree(ctx, ctx);
             goto error;
         }
 
@@ -1011,14 +3191,73 @@ error:
     return NULL;
 }
 
+verto_ctx *
+verto_convert_module(const verto_module *module, int deflt, verto_mod_ctx *mctx)
+{
+    return convert_module(module, deflt, mctx, NULL);
+}
+
 void
 verto_fire(verto_ev *ev)
 {
+    fire(ev);
+}
+
+static void
+fire(verto_ev *ev)
+{
+    verto_ctx *ctx = ev->ctx;
+
+    if (ev->queued)
+        return;
+
+    /* Over budget: carry the event over to the next iteration */
+    if (budget_exhausted(ctx)) {
+        ready_push(ctx, ev);
+        return;
+    }
+
+    dispatch(ev);
+}
+
+static void
+dispatch(verto_ev *ev)
+{
+    verto_ctx *ctx = ev->ctx;
     void *priv;
 
+    /* Out of credit to read: fire for anything else, or not at all */
+    if (ev->rated && (ev->option.io.state & VERTO_EV_FLAG_IO_READ)
+            && !rate_take(ev)) {
+        ev->option.io.state &= ~VERTO_EV_FLAG_IO_READ;
+        if (ev->option.io.state == VERTO_EV_FLAG_NONE) {
+            ev->queued = 0;
+            return;
+        }
+    }
+
+    /* Internal events only count through the events they fire */
+    if (!ev->internal) {
+        ev->fires++;
+        if (ctx->introspect)
+            ev->fired = fire_stamp();
+        if (ctx->dispatched++ == 0 && ctx->budget_usec > 0)
+            clock_gettime(CLOCK_MONOTONIC, &ctx->started);
+    }
+
+    /* Modules deliver signals one at a time */
+    if (ev->type == VERTO_EV_TYPE_SIGNAL && ev->option.signal.count == 0)
+        ev->option.signal.count = 1;
+
+    if (ctx->watchdog)
+        watchdog_enter(ctx, ev->callback);
+    ctx->firing++;
     ev->depth++;
     ev->callback(ev->ctx, ev);
     ev->depth--;
+    ctx->firing--;
+    if (ctx->watchdog)
+        watchdog_leave(ctx);
 
     if (ev->depth == 0) {
         if (!(ev->flags & VERTO_EV_FLAG_PERSIST) || ev->deleted)
@@ -1026,9 +3265,9 @@ verto_fire(verto_ev *ev)
         else {
             if (!(ev->actual & VERTO_EV_FLAG_PERSIST)) {
                 ev->actual = make_actual(ev->flags);
-                priv = ev->ctx->module->funcs->ctx_add(ev->ctx->ctx, ev, &ev->actual);
+                priv = MODFUNC(ev->ctx, ctx_add)(ev->ctx->ctx, ev, &ev->actual);
                 assert(priv); /* TODO: create an error callback */
-                ev->ctx->module->funcs->ctx_del(ev->ctx->ctx, ev, ev->ev);
+                MODFUNC(ev->ctx, ctx_del)(ev->ctx->ctx, ev, ev->ev);
                 ev->ev = priv;
             }
 
@@ -1036,8 +3275,14 @@ verto_fire(verto_ev *ev)
                 ev->option.io.state = VERTO_EV_FLAG_NONE;
             if (ev->type == VERTO_EV_TYPE_CHILD)
                 ev->option.child.status = 0;
+            if (ev->type == VERTO_EV_TYPE_SIGNAL)
+                ev->option.signal.count = 0;
         }
     }
+
+    /* Once the outermost callback has returned */
+    if (ctx->firing == 0 && ctx->defer_count > 0)
+        defer_drain(ctx);
 }
 
 void
@@ -1049,6 +3294,12 @@ verto_set_proc_status(verto_ev *ev, verto_proc_status status)
 
 void
 verto_set_fd_state(verto_ev *ev, verto_ev_flag state)
+{
+    set_fd_state(ev, state);
+}
+
+static void
+set_fd_state(verto_ev *ev, verto_ev_flag state)
 {
     /* Filter out only the io flags */
     state = state & (VERTO_EV_FLAG_IO_READ |
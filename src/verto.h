@@ -25,6 +25,7 @@
 #ifndef VERTO_H_
 #define VERTO_H_
 
+#include <stdio.h>  /* For FILE */
 #include <time.h>   /* For time_t */
 #include <unistd.h> /* For pid_t */
 
@@ -34,6 +35,8 @@ typedef HANDLE verto_proc;
 typedef DWORD verto_proc_status;
 #else
 #include <sys/types.h>
+#include <sys/uio.h> /* For struct iovec */
+#include <sys/socket.h> /* For struct sockaddr */
 typedef pid_t verto_proc;
 typedef int verto_proc_status;
 #endif
@@ -54,7 +57,8 @@ typedef enum {
     VERTO_EV_TYPE_TIMEOUT = 1 << 1,
     VERTO_EV_TYPE_IDLE = 1 << 2,
     VERTO_EV_TYPE_SIGNAL = 1 << 3,
-    VERTO_EV_TYPE_CHILD = 1 << 4
+    VERTO_EV_TYPE_CHILD = 1 << 4,
+    VERTO_EV_TYPE_USER = 1 << 5
 } verto_ev_type;
 
 typedef enum {
@@ -77,6 +81,50 @@ typedef enum {
 } verto_ev_flag;
 
 typedef void (verto_callback)(verto_ctx *ctx, verto_ev *ev);
+typedef void (verto_defer_callback)(verto_ctx *ctx, void *arg);
+typedef int (verto_visitor)(verto_ctx *ctx, verto_ev *ev, void *data);
+
+typedef enum {
+    VERTO_DUMP_JSON,
+    VERTO_DUMP_TEXT
+} verto_dump_format;
+
+/**
+ * A stall of the loop, as reported by its watchdog.  See
+ * verto_set_watchdog().
+ */
+typedef struct {
+    /** How long the loop has been away from polling, in microseconds. */
+    unsigned long usec;
+    /** The callbacks currently running, outermost first. */
+    verto_callback *const *callbacks;
+    /** The number of entries in callbacks (16 at most). */
+    size_t ncallbacks;
+    /** The number of callbacks running, which may exceed ncallbacks. */
+    size_t depth;
+} verto_stall;
+
+typedef void (verto_stall_callback)(verto_ctx *ctx, const verto_stall *stall,
+                                    void *data);
+
+/**
+ * Statistics about a verto_ctx.  See verto_get_stats().
+ */
+typedef struct {
+    /** The number of stalls detected by the watchdog. */
+    unsigned long stalls;
+    /** The longest of those stalls, in microseconds. */
+    unsigned long longest_stall_usec;
+} verto_stats;
+
+/**
+ * A reference to a verto_ev which, unlike a pointer, can be checked for
+ * validity after the event is freed.  See verto_get_handle().
+ */
+typedef struct {
+    unsigned int index;
+    unsigned int generation;
+} verto_handle;
 
 /**
  * Creates a new event context using an optionally specified implementation
@@ -187,7 +235,13 @@ verto_set_default(const char *impl, verto_ev_type reqtypes);
  * Sets the allocator to use for verto_ctx and verto_ev objects.
  *
  * If you plan to set the allocator, you MUST call this function before any
- * other verto_*() calls.
+ * other verto_*() calls.  It applies to the whole process; to use a different
+ * allocator for some contexts, see verto_new_with_allocator().
+ *
+ * If hierarchical is non-zero, the events of a verto_ctx are allocated in
+ * batches from arenas owned by the verto_ctx.  The memory of deleted events is
+ * reused by the same verto_ctx, and is only returned to the allocator, all at
+ * once, by verto_free().
  *
  * @see verto_new()
  * @see verto_default()
@@ -203,6 +257,59 @@ verto_set_default(const char *impl, verto_ev_type reqtypes);
 int
 verto_set_allocator(void *(*resize)(void *mem, size_t size), int hierarchical);
 
+/**
+ * An allocator for a single verto_ctx.
+ *
+ * @see verto_new_with_allocator()
+ */
+typedef struct {
+    /** Behaves like realloc(); resize(data, ptr, 0) must free memory at ptr. */
+    void *(*resize)(void *data, void *mem, size_t size);
+    /** Passed to every call to resize(). */
+    void *data;
+    /** Non-zero to allocate events from arenas (see verto_set_allocator()). */
+    int hierarchical;
+} verto_allocator;
+
+/**
+ * Creates a new event context which uses its own allocator.
+ *
+ * This works like verto_new(), except that the verto_ctx, its events and the
+ * memory used to manage them are allocated with allocator rather than with
+ * the allocator set by verto_set_allocator().  Memory allocated by the
+ * underlying implementation is not affected.
+ *
+ * The allocator must remain valid until the verto_ctx is freed, and is only
+ * called from the threads which use the verto_ctx.
+ *
+ * @see verto_new()
+ * @see verto_thread_pool_allocator()
+ * @param impl The implementation to use, or NULL.
+ * @param reqtypes A bitwise or'd list of required event type features.
+ * @param allocator The allocator to use, or NULL for the default one.
+ * @return A new verto_ctx, or NULL on error.  Call verto_free() when done.
+ */
+verto_ctx *
+verto_new_with_allocator(const char *impl, verto_ev_type reqtypes,
+                         const verto_allocator *allocator);
+
+/**
+ * Returns an allocator which keeps the memory of freed events in a pool for
+ * the next events created by the same thread.
+ *
+ * Use it with verto_new_with_allocator() for contexts which create and delete
+ * many short-lived events.  Other memory comes from malloc().
+ *
+ * Each thread caches up to 256 freed events.  The cache of a thread is freed
+ * when the thread exits, and that of the thread calling verto_cleanup() by
+ * verto_cleanup().  Without pthreads support, freed events are not cached:
+ * the allocator behaves like malloc() and free().
+ *
+ * @return The allocator (never NULL).
+ */
+const verto_allocator *
+verto_thread_pool_allocator(void);
+
 /**
  * Frees a verto_ctx.
  *
@@ -247,6 +354,49 @@ verto_run(verto_ctx *ctx);
 void
 verto_run_once(verto_ctx *ctx);
 
+/**
+ * Run the verto_ctx until verto_break() is called or timeout expires.
+ *
+ * @see verto_run()
+ * @see verto_break()
+ * @param ctx The verto_ctx to run.
+ * @param timeout Maximum time to run (in milliseconds).
+ */
+void
+verto_run_for(verto_ctx *ctx, time_t timeout);
+
+/**
+ * Run the verto_ctx once without blocking.
+ *
+ * Fires the events carried over from a previous iteration and those which
+ * are ready right now, then returns.
+ *
+ * @see verto_run_once()
+ * @param ctx The verto_ctx to run once.
+ */
+void
+verto_run_nowait(verto_ctx *ctx);
+
+/**
+ * Runs a function once the current callback has returned.
+ *
+ * The function runs as soon as the outermost callback firing in the
+ * verto_ctx returns, and in any case before the verto_ctx waits for events
+ * again.  Functions run in the order they were deferred, including those
+ * deferred by a deferred function.  Deferring allocates nothing but the
+ * occasional growth of a ring buffer, so it is much cheaper than an idle
+ * event.
+ *
+ * Functions which have not run when the verto_ctx is freed never run.
+ *
+ * @param ctx The verto_ctx which will run the function.
+ * @param callback The function to run.
+ * @param arg The argument to pass to the function.
+ * @return Non-zero on success, 0 on error.
+ */
+int
+verto_defer(verto_ctx *ctx, verto_defer_callback *callback, void *arg);
+
 /**
  * Exits the currently running verto_ctx.
  *
@@ -256,6 +406,67 @@ verto_run_once(verto_ctx *ctx);
 void
 verto_break(verto_ctx *ctx);
 
+/**
+ * Limits the work done in a single iteration of the verto_ctx.
+ *
+ * Once callbacks events have fired, or usec microseconds have passed since
+ * the first one fired, in the current iteration of verto_run(),
+ * verto_run_once() or verto_run_nowait(), any other ready event is carried
+ * over to the next iteration. Carried over events fire before new ones,
+ * in the order they became ready, and an event which becomes ready again
+ * while it is waiting only fires once.
+ *
+ * This prevents a flood of ready events from starving the rest of the
+ * loop (i.e. timers or the caller of verto_run_once()).
+ *
+ * @param ctx The verto_ctx to limit.
+ * @param callbacks Maximum number of callbacks per iteration (0: no limit).
+ * @param usec Maximum time per iteration in microseconds (0: no limit).
+ */
+void
+verto_set_dispatch_budget(verto_ctx *ctx, size_t callbacks,
+                          unsigned long usec);
+
+/**
+ * Watches over the verto_ctx from a separate thread, to catch it stalling.
+ *
+ * The loop stalls when it doesn't go back to polling the implementation
+ * within usec microseconds, usually because a callback blocks.  The watchdog
+ * then reports the callbacks running at the time, and counts the stall in
+ * the statistics of the verto_ctx (see verto_get_stats()).  Each stall is
+ * reported once, however long it lasts.
+ *
+ * The report is passed to callback, called from the watchdog thread, so it
+ * must only look at the verto_ctx through verto_get_stats().  If callback is
+ * NULL, the callbacks running are written out to stderr, with their symbol
+ * names where the system can find them.
+ *
+ * While a watchdog is set, verto_run() runs each iteration itself, rather
+ * than letting the implementation run its own loop.  This function must be
+ * called from the thread running the loop.
+ *
+ * @see verto_get_stats()
+ * @param ctx The verto_ctx to watch.
+ * @param usec The longest time away from polling (0: remove the watchdog).
+ * @param callback The function reporting stalls (NULL: write to stderr).
+ * @param data Passed to every call to callback.
+ * @return 1 on success or 0 on error (or if threads aren't supported).
+ */
+int
+verto_set_watchdog(verto_ctx *ctx, unsigned long usec,
+                   verto_stall_callback *callback, void *data);
+
+/**
+ * Gets the statistics of a verto_ctx.
+ *
+ * @see verto_set_watchdog()
+ * @param ctx The verto_ctx.
+ * @param stats Where to store the statistics.
+ * @return 1 on success or 0 on error.
+ */
+int
+verto_get_stats(verto_ctx *ctx, verto_stats *stats);
+
 /**
  * Re-initializes the verto_ctx.
  *
@@ -286,6 +497,11 @@ verto_reinitialize(verto_ctx *ctx);
  * If VERTO_EV_FLAG_IO_CLOSE_FD is provided the passed in fd is automatically
  * closed when the event is freed with verto_del()
  *
+ * Several events may watch the same fd, for instance one for reading and
+ * one for writing.  They then share a single registration with the module,
+ * watching the union of their interests, and each one fires only for the
+ * states it asked for (and on errors).
+ *
  * NOTE: On Windows, the underlying select() only works with sockets. As such,
  * any attempt to add a non-socket io event on Windows will produce undefined
  * results and may even crash.
@@ -332,6 +548,10 @@ verto_add_timeout(verto_ctx *ctx, verto_ev_flag flags,
  * after its execution. In either case, you may call verto_del() at any time
  * to prevent the event from executing.
  *
+ * If the implementation has no idle events, verto fires them after any
+ * iteration of the loop which had nothing else to dispatch.  This only
+ * happens when the loop is run through verto_run() and friends.
+ *
  * @see verto_del()
  * @param ctx The verto_ctx which will fire the callback.
  * @param flags The flags to set.
@@ -358,14 +578,30 @@ verto_add_idle(verto_ctx *ctx, verto_ev_flag flags,
  * NOTE: SIGCHLD is expressly not supported. If you want this notification,
  * please use verto_add_child().
  *
- * WARNNIG: Signal events can only be reliably received in the default verto_ctx
- * in some implementations.  Attempting to receive signal events in non-default
- * loops may result in assert() failures.
- *
- * WARNING: While verto does its best to protect you from crashes, there is
- * essentially no way to do signal events if you mix multiple implementations in
- * a single process. Attempting to do so will result in undefined behavior,
- * and potentially even a crash. You have been warned.
+ * Where signalfd() is available (Linux), signals are not handled by the
+ * implementation: verto blocks the signal and reads it from a single
+ * process-wide signalfd, then fires the events watching it in every
+ * verto_ctx, whatever its implementation or thread.  Deliveries which arrive
+ * before the callback runs are coalesced, see verto_get_signal_count().
+ * The signal is blocked in each thread that adds an event for it, for as
+ * long as that thread's contexts watch it, so add (and free) signal events
+ * from the thread which runs their loop.  Other threads keep their own mask:
+ * one which leaves a watched signal unblocked may take the delivery itself,
+ * with the signal's original disposition.  Children created with fork()
+ * inherit the blocked mask, and so do programs they exec(); unblock the
+ * signals in the child before exec(), or use posix_spawnattr_setsigmask().
+ * A child which handles signals itself must call verto_reinitialize() first,
+ * with VERTO_EV_FLAG_REINITIABLE signal events: until then its contexts
+ * receive no signals, so that it does not take those of its parent.
+ *
+ * WARNNIG: Otherwise, signal events can only be reliably received in the
+ * default verto_ctx in some implementations.  Attempting to receive signal
+ * events in non-default loops may result in assert() failures.
+ *
+ * WARNING: Without signalfd(), there is essentially no way to do signal
+ * events if you mix multiple implementations in a single process. Attempting
+ * to do so will result in undefined behavior, and potentially even a crash.
+ * You have been warned.
  *
  * @see verto_add_child()
  * @see verto_repeat()
@@ -380,6 +616,44 @@ verto_ev *
 verto_add_signal(verto_ctx *ctx, verto_ev_flag flags,
                  verto_callback *callback, int signal);
 
+/**
+ * Adds a callback executed when verto_trigger() is called.
+ *
+ * User events involve no file descriptor and no system call: triggering one
+ * only queues it in the verto_ctx, which fires it in its next iteration.
+ * This makes them a cheap way to drive internal state machines.
+ *
+ * All verto_ev events are automatically freed when their parent verto_ctx is
+ * freed. You do not need to free them manually. If VERTO_EV_FLAG_PERSIST is
+ * provided, the event can be triggered again after it fired, until
+ * verto_del() is called. If VERTO_EV_FLAG_PERSIST is not provided, the event
+ * will be freed automatically after its execution. In either case, you may
+ * call verto_del() at any time to prevent the event from executing.
+ *
+ * @see verto_trigger()
+ * @see verto_del()
+ * @param ctx The verto_ctx which will fire the callback.
+ * @param flags The flags to set.
+ * @param callback The callback to fire.
+ * @return The verto_ev registered with the event context.
+ */
+verto_ev *
+verto_add_user(verto_ctx *ctx, verto_ev_flag flags,
+               verto_callback *callback);
+
+/**
+ * Marks a user event as ready.
+ *
+ * The event fires in the next iteration of its verto_ctx; triggering it
+ * again before then has no effect.  This function does nothing if the
+ * verto_ev is not a user event.
+ *
+ * @see verto_add_user()
+ * @param ev The verto_ev to trigger.
+ */
+void
+verto_trigger(verto_ev *ev);
+
 /**
  * Adds a callback executed when a child process exits.
  *
@@ -389,6 +663,9 @@ verto_add_signal(verto_ctx *ctx, verto_ev_flag flags,
  * VERTO_EV_FLAG_PERSIST. You may, of course, call verto_del() at any time to
  * prevent the callback from firing.
  *
+ * If the implementation does not watch children itself, verto watches the
+ * process through a pidfd (Linux 5.3 and later) and reaps it when it exits.
+ *
  * @see verto_del()
  * @param ctx The verto_ctx which will fire the callback.
  * @param flags The flags to set.
@@ -474,6 +751,55 @@ verto_get_flags(const verto_ev *ev);
 void
 verto_set_flags(verto_ev *ev, verto_ev_flag flags);
 
+/**
+ * Rebinds a read/write verto_ev to a different file descriptor.
+ *
+ * The event keeps its callback, flags and private data; only the watched
+ * file descriptor changes. Where the implementation allows it, the existing
+ * watcher is updated in place, so this is much cheaper than calling
+ * verto_del() followed by verto_add_io(). This function may be called from
+ * within the event's own callback.
+ *
+ * If VERTO_EV_FLAG_IO_CLOSE_FD was set on the event, the previous file
+ * descriptor is closed once it is no longer watched, and only if the switch
+ * succeeded.  On error neither descriptor is closed: the event still owns
+ * the previous one, and the caller still owns fd.
+ *
+ * On error the event watches the previous file descriptor again.  In the
+ * rare case where the implementation refuses that too, the event is left
+ * stopped: verto_get_fd() still returns the previous descriptor, but the
+ * event never fires until a later verto_set_fd() succeeds.  It can still be
+ * passed to verto_del() as usual.
+ *
+ * @see verto_add_io()
+ * @see verto_get_fd()
+ * @param ev The verto_ev to rebind.
+ * @param fd The new file descriptor to watch.
+ * @return Non-zero on success, 0 on error.
+ */
+int
+verto_set_fd(verto_ev *ev, int fd);
+
+/**
+ * Caps how often a read/write verto_ev may fire for reading.
+ *
+ * The event gets credit for rate callbacks per second, and can save up to
+ * burst of them.  Once it runs out, verto stops watching the fd for reading
+ * with verto_set_flags() (so VERTO_EV_FLAG_IO_READ is missing from
+ * verto_get_flags() meanwhile), and watches it again as soon as the event
+ * can fire.  The event still fires for writing and errors in between.
+ *
+ * Verto uses a single timer for all the rate limited events of a verto_ctx.
+ *
+ * @see verto_add_io()
+ * @param ev The verto_ev to limit.
+ * @param rate The read callbacks per second (0: remove the limit).
+ * @param burst The read callbacks which may fire in a row (at least 1).
+ * @return Non-zero on success, 0 on error.
+ */
+int
+verto_set_io_rate(verto_ev *ev, unsigned int rate, unsigned int burst);
+
 /**
  * Gets the file descriptor associated with a read/write verto_ev.
  *
@@ -514,6 +840,19 @@ verto_get_interval(const verto_ev *ev);
 int
 verto_get_signal(const verto_ev *ev);
 
+/**
+ * Gets the number of deliveries of the signal handled by this callback.
+ *
+ * Signals which arrive while the event is waiting to fire are coalesced into
+ * a single callback.  Only valid from within the callback.
+ *
+ * @see verto_add_signal()
+ * @param ev The verto_ev to retrieve the count from.
+ * @return The count (at least 1), or 0 if not a signal event.
+ */
+unsigned int
+verto_get_signal_count(const verto_ev *ev);
+
 /**
  * Gets the process associated with a child verto_ev.
  *
@@ -545,6 +884,120 @@ verto_get_proc_status(const verto_ev *ev);
 verto_ctx *
 verto_get_ctx(const verto_ev *ev);
 
+/**
+ * Gets a handle for a verto_ev.
+ *
+ * Non-persistent events are freed after their callback runs, after which a
+ * pointer to them must not be used.  A handle, on the other hand, can be kept
+ * and checked at any time with verto_find_handle(), in constant time.
+ *
+ * @see verto_find_handle()
+ * @param ev The verto_ev to get a handle for.
+ * @return The handle (which never matches an event if ev is NULL).
+ */
+verto_handle
+verto_get_handle(const verto_ev *ev);
+
+/**
+ * Gets the verto_ev referenced by a handle.
+ *
+ * @see verto_get_handle()
+ * @param ctx The verto_ctx of the event.
+ * @param handle The handle of the event.
+ * @return The verto_ev, or NULL if it was deleted or freed.
+ */
+verto_ev *
+verto_find_handle(verto_ctx *ctx, verto_handle handle);
+
+/**
+ * Finds an io event watching a file descriptor.
+ *
+ * If several events watch fd, the one added (or moved to fd with
+ * verto_set_fd()) last is returned.
+ *
+ * @see verto_add_io()
+ * @param ctx The verto_ctx to search.
+ * @param fd The file descriptor.
+ * @return The verto_ev, or NULL if no event watches fd.
+ */
+verto_ev *
+verto_find_io(verto_ctx *ctx, int fd);
+
+/**
+ * Calls a function for each event of a verto_ctx.
+ *
+ * The events verto creates for its own use are not visited.  The visitor
+ * may delete any event; events it adds are not visited.
+ *
+ * @see verto_dump()
+ * @param ctx The verto_ctx whose events to visit.
+ * @param visitor The function to call, which returns zero to stop the walk.
+ * @param data Passed to every call to visitor.
+ * @return The number of events visited.
+ */
+size_t
+verto_foreach_event(verto_ctx *ctx, verto_visitor *visitor, void *data);
+
+/**
+ * Makes a verto_ctx record when the callback of each event runs.
+ *
+ * This is disabled by default, so that dispatching a callback costs no clock
+ * read: verto_get_time_since_fire() and verto_dump() then only know the
+ * events' fire counts.
+ *
+ * @see verto_get_time_since_fire()
+ * @param ctx The verto_ctx.
+ * @param enable Non-zero to record the time of the callbacks, zero to stop.
+ */
+void
+verto_set_introspection(verto_ctx *ctx, int enable);
+
+/**
+ * Gets the number of times the callback of a verto_ev has run.
+ *
+ * @see verto_get_time_since_fire()
+ * @param ev The verto_ev
+ * @return The number of times the callback has run.
+ */
+unsigned int
+verto_get_fire_count(const verto_ev *ev);
+
+/**
+ * Gets the time elapsed since the callback of a verto_ev last ran.
+ *
+ * The time is that of a coarse clock, precise to a few milliseconds, and
+ * wraps around after 49 days.  Only the callbacks run while introspection is
+ * enabled in the verto_ctx are recorded.
+ *
+ * @see verto_set_introspection()
+ * @see verto_get_fire_count()
+ * @param ev The verto_ev
+ * @return The time in milliseconds, or -1 if no callback run was recorded.
+ */
+long
+verto_get_time_since_fire(const verto_ev *ev);
+
+/**
+ * Writes out the events of a verto_ctx, to find out what a loop holds.
+ *
+ * For each event visited by verto_foreach_event(), this gives its type, its
+ * callback, its flags and those actually set in the implementation, its fd,
+ * interval, signal or pid, how many times it fired and, with
+ * verto_set_introspection(), how long ago.
+ *
+ * VERTO_DUMP_JSON writes an object with the implementation name ("module")
+ * and the array of events ("events"); VERTO_DUMP_TEXT writes one line per
+ * event.
+ *
+ * @see verto_foreach_event()
+ * @param ctx The verto_ctx to dump.
+ * @param file The stream to write to.
+ * @param format The output format.
+ * @return 1 on success or 0 on error.
+ */
+int
+verto_dump(verto_ctx *ctx, FILE *file, verto_dump_format format);
+
 /**
  * Removes an event from from the event context and frees it.
  *
@@ -561,14 +1014,528 @@ void
 verto_del(verto_ev *ev);
 
 /**
- * Returns the event types supported by this implementation.
+ * Returns the event types supported by this verto_ctx.
  *
+ * This includes the types which verto provides on top of the implementation
+ * when it lacks them: idle events, and where the system allows it, signal
+ * (signalfd) and child (pidfd) events.
+ *
+ * @see verto_get_native_types()
  * @param ctx The verto_ctx to query.
  * @return The event types supported.
  */
 verto_ev_type
 verto_get_supported_types(verto_ctx *ctx);
 
+/**
+ * Returns the event types supported by the implementation itself.
+ *
+ * @see verto_get_supported_types()
+ * @param ctx The verto_ctx to query.
+ * @return The event types supported natively.
+ */
+verto_ev_type
+verto_get_native_types(verto_ctx *ctx);
+
+/*** BUFFERED STREAMS ***/
+
+typedef struct verto_stream verto_stream;
+
+typedef void (verto_stream_callback)(verto_stream *stream, int error);
+
+/**
+ * Creates a buffered stream on top of a persistent read/write verto_ev.
+ *
+ * Incoming data is read with readv() straight into a chain of buffers owned
+ * by the stream, and callback is called with error set to 0 each time new
+ * data has been appended. Use verto_stream_peek() to look at the buffered
+ * data in place and verto_stream_consume() to drop it (or
+ * verto_stream_read() to copy it out).
+ *
+ * Outgoing data is queued with verto_stream_write() or
+ * verto_stream_write_ref() and flushed with writev() when the fd is
+ * writable. VERTO_EV_FLAG_IO_WRITE is only set on the underlying event while
+ * the output queue is non-empty, so verto_set_flags() is called only when
+ * the queue goes from empty to non-empty and back.
+ *
+ * When the peer closes the connection, callback is called with error set to
+ * 0 and verto_stream_is_eof() returns non-zero. On a read or write error,
+ * callback is called once with error set to the errno value. In both cases no
+ * further data will be read. A write error also drops the queued output
+ * (releasing the buffers of verto_stream_write_ref()), and later writes fail.
+ *
+ * The only flags accepted are VERTO_EV_FLAG_PRIORITY_*,
+ * VERTO_EV_FLAG_REINITIABLE and VERTO_EV_FLAG_IO_CLOSE_FD. Reading can be
+ * paused by clearing VERTO_EV_FLAG_IO_READ on the event returned by
+ * verto_stream_get_ev(). The stream is freed along with its event, either
+ * by verto_stream_free() or when the verto_ctx is freed.
+ *
+ * @see verto_stream_free()
+ * @see verto_add_io()
+ * @param ctx The verto_ctx which will drive the stream.
+ * @param flags The flags to set on the underlying event.
+ * @param callback The callback to fire when data arrives or on EOF/error.
+ * @param fd The non-blocking file descriptor to buffer.
+ * @return The new verto_stream, or NULL on error.
+ */
+verto_stream *
+verto_stream_new(verto_ctx *ctx, verto_ev_flag flags,
+                 verto_stream_callback *callback, int fd);
+
+/**
+ * Frees a verto_stream, its buffers and its underlying verto_ev.
+ *
+ * Any queued output which was not yet written is discarded. This function
+ * may be called from within the stream's callback.
+ *
+ * @param stream The verto_stream to free.
+ */
+void
+verto_stream_free(verto_stream *stream);
+
+/**
+ * Gets the verto_ev which drives a verto_stream.
+ *
+ * This is a borrowed reference; do not call verto_del() or
+ * verto_set_private() on it.
+ *
+ * @param stream The verto_stream.
+ * @return The underlying verto_ev.
+ */
+verto_ev *
+verto_stream_get_ev(const verto_stream *stream);
+
+/**
+ * Sets the private pointer of the verto_stream.
+ *
+ * @param stream The verto_stream.
+ * @param priv The private value to store.
+ */
+void
+verto_stream_set_private(verto_stream *stream, void *priv);
+
+/**
+ * Gets the private pointer of the verto_stream.
+ *
+ * @param stream The verto_stream.
+ * @return The private pointer.
+ */
+void *
+verto_stream_get_private(const verto_stream *stream);
+
+/**
+ * Returns non-zero once the peer has closed the stream.
+ *
+ * @param stream The verto_stream.
+ * @return Non-zero if EOF was read.
+ */
+int
+verto_stream_is_eof(const verto_stream *stream);
+
+/**
+ * Gets the number of buffered bytes which can be read.
+ *
+ * @param stream The verto_stream.
+ * @return The number of bytes in the input buffer.
+ */
+size_t
+verto_stream_get_readable(const verto_stream *stream);
+
+/**
+ * Describes the buffered input without copying it.
+ *
+ * Fills up to iovcnt entries of iov with pointers into the input buffer, in
+ * order. The memory stays valid until verto_stream_consume(),
+ * verto_stream_read() or verto_stream_free() is called, or until control
+ * returns to the loop.
+ *
+ * @see verto_stream_consume()
+ * @param stream The verto_stream.
+ * @param iov The array to fill.
+ * @param iovcnt The number of entries in iov.
+ * @return The number of entries filled.
+ *
+ * NOTE: Not available on WIN32, which has no struct iovec.
+ */
+#ifndef WIN32
+int
+verto_stream_peek(const verto_stream *stream, struct iovec *iov, int iovcnt);
+#endif
+
+/**
+ * Drops bytes from the front of the input buffer.
+ *
+ * @see verto_stream_peek()
+ * @param stream The verto_stream.
+ * @param len The number of bytes to drop (clamped to what is buffered).
+ */
+void
+verto_stream_consume(verto_stream *stream, size_t len);
+
+/**
+ * Copies bytes out of the input buffer and drops them.
+ *
+ * @param stream The verto_stream.
+ * @param buf The destination.
+ * @param len The size of buf.
+ * @return The number of bytes copied.
+ */
+size_t
+verto_stream_read(verto_stream *stream, void *buf, size_t len);
+
+/**
+ * Queues a copy of data for writing.
+ *
+ * Small writes are coalesced into the free space at the tail of the output
+ * queue, so they end up in a single iovec.
+ *
+ * @see verto_stream_write_ref()
+ * @param stream The verto_stream.
+ * @param data The data to write.
+ * @param len The length of data.
+ * @return Non-zero on success, 0 on error.
+ */
+int
+verto_stream_write(verto_stream *stream, const void *data, size_t len);
+
+/**
+ * Queues data for writing without copying it.
+ *
+ * The memory must stay valid until release is called, which happens once
+ * all of it has been written or the stream is freed. release may be NULL
+ * for static data.
+ *
+ * @see verto_stream_write()
+ * @param stream The verto_stream.
+ * @param data The data to write.
+ * @param len The length of data.
+ * @param release Called with data when the stream no longer needs it.
+ * @return Non-zero on success, 0 on error.
+ */
+int
+verto_stream_write_ref(verto_stream *stream, const void *data, size_t len,
+                       void (*release)(void *data));
+
+/**
+ * Gets the number of queued bytes which have not been written yet.
+ *
+ * @param stream The verto_stream.
+ * @return The number of bytes in the output queue.
+ */
+size_t
+verto_stream_get_pending(const verto_stream *stream);
+
+/*** ZERO-COPY RELAYS ***/
+
+typedef struct verto_relay verto_relay;
+
+typedef void (verto_relay_callback)(verto_relay *relay, int error);
+
+/**
+ * Relays data from one file descriptor to another, driven by IO events.
+ *
+ * Data is moved by the kernel where possible: with sendfile() if infd is a
+ * regular file, otherwise with splice() through an internal pipe. If
+ * neither is available for the given descriptors, a user-space buffer is
+ * used instead.
+ *
+ * Both descriptors must be non-blocking. The relay only waits for infd to
+ * be readable while there is room left in the pipe/buffer, and only waits
+ * for outfd to be writable while there is buffered data, so a slow reader
+ * applies back-pressure to a fast writer. At most 1 MiB is moved per
+ * wakeup.
+ *
+ * callback is called once, when count bytes (or everything until EOF if
+ * count is 0) have been written to outfd, with error set to 0, or when an
+ * error occurs, with error set to the errno value. The relay then stops,
+ * but must still be freed with verto_relay_free() (which may be done from
+ * the callback). Neither descriptor is closed by the relay.
+ *
+ * The only flags accepted are VERTO_EV_FLAG_PRIORITY_* and
+ * VERTO_EV_FLAG_REINITIABLE. Like other events, relays are freed
+ * automatically when their verto_ctx is freed.
+ *
+ * @see verto_relay_free()
+ * @param ctx The verto_ctx which will drive the relay.
+ * @param flags The flags to set on the underlying events.
+ * @param callback The callback to fire on completion or error.
+ * @param infd The file descriptor to read from.
+ * @param outfd The file descriptor to write to.
+ * @param count The number of bytes to relay, or 0 to relay until EOF.
+ * @return The new verto_relay, or NULL on error.
+ */
+verto_relay *
+verto_relay_new(verto_ctx *ctx, verto_ev_flag flags,
+                verto_relay_callback *callback, int infd, int outfd,
+                size_t count);
+
+/**
+ * Stops and frees a verto_relay.
+ *
+ * @param relay The verto_relay to free.
+ */
+void
+verto_relay_free(verto_relay *relay);
+
+/**
+ * Gets the number of bytes written to the output so far.
+ *
+ * @param relay The verto_relay.
+ * @return The number of bytes relayed.
+ */
+size_t
+verto_relay_get_transferred(const verto_relay *relay);
+
+/**
+ * Sets the private pointer of the verto_relay.
+ *
+ * @param relay The verto_relay.
+ * @param priv The private value to store.
+ */
+void
+verto_relay_set_private(verto_relay *relay, void *priv);
+
+/**
+ * Gets the private pointer of the verto_relay.
+ *
+ * @param relay The verto_relay.
+ * @return The private pointer.
+ */
+void *
+verto_relay_get_private(const verto_relay *relay);
+
+/*** DATAGRAMS ***/
+
+/* Not available on WIN32, which lacks the BSD socket headers included above */
+#ifndef WIN32
+
+typedef struct verto_dgram verto_dgram;
+
+/**
+ * A datagram received by a verto_dgram.
+ */
+typedef struct {
+    /** The payload, in the receive ring of the verto_dgram. */
+    void *data;
+    /** The length of the payload. */
+    size_t len;
+    /** The sender, or NULL if unknown (i.e. on a connected socket). */
+    const struct sockaddr *addr;
+    /** The length of addr. */
+    socklen_t addrlen;
+    /** Non-zero if the datagram was cut short to fit in the ring. */
+    int truncated;
+} verto_datagram;
+
+typedef void (verto_dgram_callback)(verto_dgram *dgram,
+                                    const verto_datagram *msgs, size_t count,
+                                    int error);
+
+/**
+ * Creates a batched datagram socket on top of a persistent read/write
+ * verto_ev.
+ *
+ * Whenever fd is readable, up to batch datagrams are received at once with
+ * recvmmsg() (or one recvmsg() at a time where it is missing) into a ring
+ * allocated up front, with room for batch datagrams of maxsize bytes.
+ * callback is then called with them and error set to 0.  The datagrams
+ * are only valid until the callback returns.
+ *
+ * Outgoing datagrams are queued with verto_dgram_send(), and flushed with
+ * sendmmsg() (or sendmsg()) when fd is writable; VERTO_EV_FLAG_IO_WRITE is
+ * only set on the underlying event while the queue is non-empty.
+ *
+ * Errors are reported by calling callback with no datagrams and error set
+ * to the errno value; a datagram which can't be sent is dropped.  The
+ * verto_dgram keeps going in either case.
+ *
+ * The only flags accepted are VERTO_EV_FLAG_PRIORITY_*,
+ * VERTO_EV_FLAG_REINITIABLE and VERTO_EV_FLAG_IO_CLOSE_FD. The verto_dgram
+ * is freed along with its event, either by verto_dgram_free() or when the
+ * verto_ctx is freed.
+ *
+ * @see verto_dgram_free()
+ * @see verto_dgram_send()
+ * @param ctx The verto_ctx which will drive the socket.
+ * @param flags The flags to set on the underlying event.
+ * @param callback The callback to fire when datagrams arrive or on error.
+ * @param fd The non-blocking datagram socket.
+ * @param batch The most datagrams received per wakeup (0: 32).
+ * @param maxsize The largest datagram received whole (0: 2048 bytes).
+ * @return The new verto_dgram, or NULL on error.
+ */
+verto_dgram *
+verto_dgram_new(verto_ctx *ctx, verto_ev_flag flags,
+                verto_dgram_callback *callback, int fd, size_t batch,
+                size_t maxsize);
+
+/**
+ * Frees a verto_dgram, its ring, its queue and its underlying verto_ev.
+ *
+ * Queued datagrams which were not sent yet are discarded. This function
+ * may be called from within the callback.
+ *
+ * @param dgram The verto_dgram to free.
+ */
+void
+verto_dgram_free(verto_dgram *dgram);
+
+/**
+ * Gets the verto_ev which drives a verto_dgram.
+ *
+ * This is a borrowed reference; do not call verto_del() or
+ * verto_set_private() on it.
+ *
+ * @param dgram The verto_dgram.
+ * @return The underlying verto_ev.
+ */
+verto_ev *
+verto_dgram_get_ev(const verto_dgram *dgram);
+
+/**
+ * Sets the private pointer of the verto_dgram.
+ *
+ * @param dgram The verto_dgram.
+ * @param priv The private value to store.
+ */
+void
+verto_dgram_set_private(verto_dgram *dgram, void *priv);
+
+/**
+ * Gets the private pointer of the verto_dgram.
+ *
+ * @param dgram The verto_dgram.
+ * @return The private pointer.
+ */
+void *
+verto_dgram_get_private(const verto_dgram *dgram);
+
+/**
+ * Queues a datagram to be sent once the socket is writable.
+ *
+ * The data is copied.
+ *
+ * @param dgram The verto_dgram.
+ * @param data The payload.
+ * @param len The length of the payload.
+ * @param addr The destination, or NULL on a connected socket.
+ * @param addrlen The length of addr.
+ * @return Non-zero on success, 0 on error.
+ */
+int
+verto_dgram_send(verto_dgram *dgram, const void *data, size_t len,
+                 const struct sockaddr *addr, socklen_t addrlen);
+
+/**
+ * Gets the number of queued datagrams which have not been sent yet.
+ *
+ * @param dgram The verto_dgram.
+ * @return The number of datagrams in the output queue.
+ */
+size_t
+verto_dgram_get_pending(const verto_dgram *dgram);
+
+#endif /* WIN32 */
+
+/*** LISTENERS ***/
+
+typedef void (verto_accept_callback)(verto_ctx *ctx, verto_ev *ev, int fd);
+
+/**
+ * Accepts connections on a listening socket.
+ *
+ * Whenever listen_fd is readable, up to max_per_wakeup connections are
+ * accepted in a row, with accept4() where available, and each new socket
+ * is passed to on_accept as fd, already non-blocking and close-on-exec.
+ * on_accept owns it from then on.
+ *
+ * When the process runs out of file descriptors, the pending connections
+ * can't be accepted and would keep the loop waking up.  The listener holds
+ * a reserve descriptor, which it closes to accept and drop each of them
+ * instead, so the clients see their connection closed.
+ *
+ * If accept fails for another reason than a transient one, on_accept is
+ * called with fd set to -1 and errno set.  on_accept may delete ev, which
+ * stops the accepting.
+ *
+ * The returned event is persistent, and uses its private pointer (see
+ * verto_set_private()) for the listener, so it must not be replaced.  The
+ * only flags accepted are VERTO_EV_FLAG_PRIORITY_*,
+ * VERTO_EV_FLAG_REINITIABLE and VERTO_EV_FLAG_IO_CLOSE_FD.
+ *
+ * @see verto_del()
+ * @param ctx The verto_ctx which will drive the listener.
+ * @param listen_fd The listening socket (which should be non-blocking).
+ * @param flags The flags to set on the event.
+ * @param on_accept The callback to fire for each new connection.
+ * @param max_per_wakeup The most connections accepted per wakeup (0: 1).
+ * @return The verto_ev accepting connections, or NULL on error.
+ */
+verto_ev *
+verto_add_listener(verto_ctx *ctx, int listen_fd, verto_ev_flag flags,
+                   verto_accept_callback *on_accept, size_t max_per_wakeup);
+
+/*** FIBERS ***/
+
+typedef void (verto_fiber_func)(void *arg);
+
+/**
+ * Runs a function on its own stack, as a fiber driven by the verto_ctx.
+ *
+ * The fiber starts in the next iteration of the verto_ctx and runs until
+ * it calls verto_wait_io(), verto_sleep() or verto_yield(), which suspend
+ * the fiber (and only the fiber) until the awaited event fires.  This lets
+ * protocol code be written as straight-line code while the loop stays
+ * single-threaded.  The fiber ends when func returns.
+ *
+ * Stacks are mapped with a guard page below them, and are kept in a per
+ * thread pool when their fiber ends, to be reused by fibers asking for the
+ * same size.  A fiber still suspended when its verto_ctx is freed is
+ * dropped without ever being resumed.
+ *
+ * This function always fails where ucontext is not available.
+ *
+ * @param ctx The verto_ctx which will drive the fiber.
+ * @param func The function to run.
+ * @param arg The argument to pass to func.
+ * @param stacksize The stack size in bytes, or 0 for the default (256 KiB).
+ * @return Non-zero on success, 0 on error.
+ */
+int
+verto_spawn(verto_ctx *ctx, verto_fiber_func *func, void *arg,
+            size_t stacksize);
+
+/**
+ * Suspends the current fiber until fd is ready.
+ *
+ * @see verto_spawn()
+ * @param fd The file descriptor to wait for.
+ * @param flags VERTO_EV_FLAG_IO_READ and/or VERTO_EV_FLAG_IO_WRITE.
+ * @return The state of fd (see verto_get_fd_state()), or
+ *         VERTO_EV_FLAG_NONE on error or outside of a fiber.
+ */
+verto_ev_flag
+verto_wait_io(int fd, verto_ev_flag flags);
+
+/**
+ * Suspends the current fiber for ms milliseconds.
+ *
+ * @see verto_spawn()
+ * @param ms The time to sleep (in milliseconds).
+ * @return Non-zero on success, 0 on error or outside of a fiber.
+ */
+int
+verto_sleep(time_t ms);
+
+/**
+ * Suspends the current fiber until the next iteration of its verto_ctx.
+ *
+ * @see verto_spawn()
+ * @return Non-zero on success, 0 outside of a fiber.
+ */
+int
+verto_yield(void);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif /* __cplusplus */
@@ -0,0 +1,298 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*** C++ BINDINGS (header-only, C++11) ***/
+
+#ifndef VERTO_HPP_
+#define VERTO_HPP_
+
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <verto.h>
+
+namespace verto {
+
+/**
+ * A non-owning handle to a verto_ev.
+ *
+ * Like the verto_ev it wraps, the handle becomes invalid once the event is
+ * freed: by del(), after a non-persistent event fired, or when its context
+ * is freed.
+ */
+class event {
+public:
+    event(verto_ev *ev = nullptr) noexcept : ev_(ev) {}
+
+    verto_ev *get() const noexcept { return ev_; }
+    explicit operator bool() const noexcept { return ev_ != nullptr; }
+
+    verto_ev_type type() const { return verto_get_type(ev_); }
+    verto_ev_flag flags() const { return verto_get_flags(ev_); }
+    void set_flags(verto_ev_flag flags) { verto_set_flags(ev_, flags); }
+    int fd() const { return verto_get_fd(ev_); }
+    verto_ev_flag fd_state() const { return verto_get_fd_state(ev_); }
+    int set_fd(int fd) { return verto_set_fd(ev_, fd); }
+    time_t interval() const { return verto_get_interval(ev_); }
+    int signal() const { return verto_get_signal(ev_); }
+    unsigned int signal_count() const { return verto_get_signal_count(ev_); }
+    verto_proc proc() const { return verto_get_proc(ev_); }
+    verto_proc_status proc_status() const { return verto_get_proc_status(ev_); }
+    void trigger() { verto_trigger(ev_); }
+
+    /** Deletes the event; the handle is reset. */
+    void del() { verto_del(ev_); ev_ = nullptr; }
+
+private:
+    verto_ev *ev_;
+};
+
+/**
+ * An owning handle to a verto_ev: deletes the event when destroyed.
+ *
+ * Only use it for events which cannot free themselves behind its back,
+ * that is persistent events.
+ */
+class unique_event {
+public:
+    unique_event() noexcept {}
+    explicit unique_event(event ev) noexcept : ev_(ev) {}
+    unique_event(unique_event &&other) noexcept : ev_(other.release()) {}
+    unique_event(const unique_event &) = delete;
+    unique_event &operator=(const unique_event &) = delete;
+    ~unique_event() { reset(); }
+
+    unique_event &operator=(unique_event &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            ev_ = other.release();
+        }
+        return *this;
+    }
+
+    event get() const noexcept { return ev_; }
+    const event *operator->() const noexcept { return &ev_; }
+    event *operator->() noexcept { return &ev_; }
+    explicit operator bool() const noexcept { return bool(ev_); }
+
+    event release() noexcept { event ev = ev_; ev_ = event(); return ev; }
+    void reset() { if (ev_) ev_.del(); }
+
+private:
+    event ev_;
+};
+
+namespace detail {
+
+/* The callable lives in the event's private pointer when it fits there
+ * and can be copied bytewise (empty lambdas, lambdas capturing a single
+ * pointer or reference...); otherwise it is moved to the heap and
+ * destroyed when the event is freed.  Each callable type gets its own
+ * trampolines, so no type erasure happens at runtime. */
+template <typename F>
+struct slot {
+    static constexpr bool inplace = sizeof(F) <= sizeof(void *)
+                                    && alignof(F) <= alignof(void *)
+                                    && std::is_trivially_copyable<F>::value;
+
+    template <typename Fn>
+    static void *store(Fn &&f, std::true_type)
+    {
+        void *priv = nullptr;
+        std::memcpy(&priv, static_cast<const void *>(&f), sizeof(F));
+        return priv;
+    }
+
+    template <typename Fn>
+    static void *store(Fn &&f, std::false_type)
+    {
+        return new (std::nothrow) F(std::forward<Fn>(f));
+    }
+
+    static void call(verto_ev *ev, std::true_type)
+    {
+        alignas(F) unsigned char buf[sizeof(F)];
+        void *priv = verto_get_private(ev);
+
+        std::memcpy(buf, &priv, sizeof(F));
+        (*reinterpret_cast<F *>(buf))(event(ev));
+    }
+
+    static void call(verto_ev *ev, std::false_type)
+    {
+        (*static_cast<F *>(verto_get_private(ev)))(event(ev));
+    }
+
+    static void callback(verto_ctx *, verto_ev *ev)
+    {
+        call(ev, std::integral_constant<bool, inplace>());
+    }
+
+    static void destroy(verto_ctx *, verto_ev *ev)
+    {
+        delete static_cast<F *>(verto_get_private(ev));
+    }
+
+    /* Attaches f to the event created by add(callback) */
+    template <typename Fn, typename Add>
+    static event attach(Fn &&f, Add add)
+    {
+        std::integral_constant<bool, inplace> where;
+        void *priv = store(std::forward<Fn>(f), where);
+        verto_ev *ev;
+
+        if (!inplace && !priv)
+            return event();
+
+        ev = add(&slot::callback);
+        if (!ev) {
+            if (!inplace)
+                delete static_cast<F *>(priv);
+            return event();
+        }
+
+        verto_set_private(ev, priv, inplace ? nullptr : &slot::destroy);
+        return event(ev);
+    }
+};
+
+template <typename F>
+using slot_for = slot<typename std::decay<F>::type>;
+
+} /* namespace detail */
+
+/**
+ * An owning handle to a verto_ctx: frees the context when destroyed.
+ *
+ * Callbacks are any callable taking a verto::event.  Adding an event never
+ * allocates for callables which fit in a pointer and are trivially
+ * copyable (see detail::slot); larger ones are moved to the heap.
+ */
+class context {
+public:
+    /** See verto_new(); check the result with operator bool. */
+    explicit context(const char *impl = nullptr,
+                     verto_ev_type reqtypes = VERTO_EV_TYPE_NONE)
+        : ctx_(verto_new(impl, reqtypes)) {}
+
+    /** Wraps an existing verto_ctx, taking over its reference. */
+    static context adopt(verto_ctx *ctx) noexcept
+    {
+        return context(ctx, adopt_tag());
+    }
+
+    /** See verto_default(). */
+    static context default_context(const char *impl = nullptr,
+                                   verto_ev_type reqtypes = VERTO_EV_TYPE_NONE)
+    {
+        return adopt(verto_default(impl, reqtypes));
+    }
+
+    context(context &&other) noexcept : ctx_(other.ctx_) { other.ctx_ = nullptr; }
+    context(const context &) = delete;
+    context &operator=(const context &) = delete;
+    ~context() { verto_free(ctx_); }
+
+    context &operator=(context &&other) noexcept
+    {
+        if (this != &other) {
+            verto_free(ctx_);
+            ctx_ = other.ctx_;
+            other.ctx_ = nullptr;
+        }
+        return *this;
+    }
+
+    verto_ctx *get() const noexcept { return ctx_; }
+    explicit operator bool() const noexcept { return ctx_ != nullptr; }
+
+    void run() { verto_run(ctx_); }
+    void run_once() { verto_run_once(ctx_); }
+    void run_nowait() { verto_run_nowait(ctx_); }
+    void run_for(time_t ms) { verto_run_for(ctx_, ms); }
+    void break_loop() { verto_break(ctx_); }
+    int reinitialize() { return verto_reinitialize(ctx_); }
+    verto_ev_type supported_types() const { return verto_get_supported_types(ctx_); }
+
+    template <typename F>
+    event add_io(verto_ev_flag flags, int fd, F &&f)
+    {
+        verto_ctx *ctx = ctx_;
+        return detail::slot_for<F>::attach(std::forward<F>(f),
+            [=](verto_callback *cb) { return verto_add_io(ctx, flags, cb, fd); });
+    }
+
+    template <typename F>
+    event add_timeout(verto_ev_flag flags, time_t ms, F &&f)
+    {
+        verto_ctx *ctx = ctx_;
+        return detail::slot_for<F>::attach(std::forward<F>(f),
+            [=](verto_callback *cb) { return verto_add_timeout(ctx, flags, cb, ms); });
+    }
+
+    template <typename F>
+    event add_idle(verto_ev_flag flags, F &&f)
+    {
+        verto_ctx *ctx = ctx_;
+        return detail::slot_for<F>::attach(std::forward<F>(f),
+            [=](verto_callback *cb) { return verto_add_idle(ctx, flags, cb); });
+    }
+
+    template <typename F>
+    event add_signal(verto_ev_flag flags, int signum, F &&f)
+    {
+        verto_ctx *ctx = ctx_;
+        return detail::slot_for<F>::attach(std::forward<F>(f),
+            [=](verto_callback *cb) { return verto_add_signal(ctx, flags, cb, signum); });
+    }
+
+    template <typename F>
+    event add_child(verto_ev_flag flags, verto_proc proc, F &&f)
+    {
+        verto_ctx *ctx = ctx_;
+        return detail::slot_for<F>::attach(std::forward<F>(f),
+            [=](verto_callback *cb) { return verto_add_child(ctx, flags, cb, proc); });
+    }
+
+    template <typename F>
+    event add_user(verto_ev_flag flags, F &&f)
+    {
+        verto_ctx *ctx = ctx_;
+        return detail::slot_for<F>::attach(std::forward<F>(f),
+            [=](verto_callback *cb) { return verto_add_user(ctx, flags, cb); });
+    }
+
+private:
+    struct adopt_tag {};
+    context(verto_ctx *ctx, adopt_tag) noexcept : ctx_(ctx) {}
+
+    verto_ctx *ctx_;
+};
+
+} /* namespace verto */
+
+#endif /* VERTO_HPP_ */
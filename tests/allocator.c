@@ -0,0 +1,170 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "test.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#define EVENTS 100
+
+typedef struct {
+    size_t allocs;
+    size_t frees;
+} counts;
+
+static int fired;
+
+static void *
+counting_resize(void *data, void *mem, size_t size)
+{
+    counts *c = data;
+
+    if (size == 0) {
+        if (mem)
+            c->frees++;
+        free(mem);
+        return NULL;
+    }
+
+    if (!mem)
+        c->allocs++;
+    return realloc(mem, size);
+}
+
+static void
+count_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+    (void) ev;
+    fired++;
+}
+
+static void
+break_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    verto_break(ctx);
+}
+
+/* Runs a few events on a context with the given allocator */
+static int
+exercise(const verto_allocator *allocator)
+{
+    verto_ctx *ctx;
+    verto_ev *evs[EVENTS];
+    int i;
+
+    ctx = verto_new_with_allocator(NULL, VERTO_EV_TYPE_NONE, allocator);
+    if (!ctx)
+        return 0;
+
+    for (i = 0; i < EVENTS; i++)
+        evs[i] = passert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE,
+                                           count_cb, 1));
+    for (i = 0; i < EVENTS; i += 2)
+        verto_del(evs[i]);
+    for (i = 0; i < EVENTS / 2; i++)
+        passert(verto_add_idle(ctx, VERTO_EV_FLAG_PERSIST, count_cb));
+    passert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, break_cb, 20));
+
+    fired = 0;
+    verto_run(ctx);
+    verto_free(ctx);
+    return fired > 0;
+}
+
+#ifdef HAVE_PTHREAD
+/* The pool of a thread is freed when it exits */
+static void *
+pool_thread(void *arg)
+{
+    (void) arg;
+    return exercise(verto_thread_pool_allocator()) ? arg : NULL;
+}
+
+static int
+exercise_thread(void)
+{
+    pthread_t thread;
+    void *ok = NULL;
+
+    if (pthread_create(&thread, NULL, pool_thread, &ok) != 0
+            || pthread_join(thread, &ok) != 0)
+        return 0;
+    return ok != NULL;
+}
+#else
+#define exercise_thread() 1
+#endif
+
+static void
+cb(verto_ctx *ctx, verto_ev *ev)
+{
+    verto_allocator allocator;
+    counts c;
+
+    (void) ev;
+    retval = 1;
+
+    /* Everything the contexts allocate goes back to their own allocator */
+    memset(&c, 0, sizeof(c));
+    allocator.resize = counting_resize;
+    allocator.data = &c;
+    allocator.hierarchical = 0;
+    if (!exercise(&allocator) || c.allocs <= EVENTS
+            || c.allocs != c.frees) {
+        printf("ERROR: Allocations: %lu, frees: %lu!\n",
+               (unsigned long) c.allocs, (unsigned long) c.frees);
+        goto out;
+    }
+
+    memset(&c, 0, sizeof(c));
+    allocator.hierarchical = 1;
+    if (!exercise(&allocator) || c.allocs == 0 || c.allocs >= EVENTS
+            || c.allocs != c.frees) {
+        printf("ERROR: Hierarchical allocations: %lu, frees: %lu!\n",
+               (unsigned long) c.allocs, (unsigned long) c.frees);
+        goto out;
+    }
+
+    if (!exercise(verto_thread_pool_allocator())
+            || !exercise(verto_thread_pool_allocator())
+            || !exercise_thread()) {
+        printf("ERROR: The thread pool allocator failed!\n");
+        goto out;
+    }
+
+    retval = 0;
+
+out:
+    verto_break(ctx);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, cb, 0));
+    return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "test.h"
+
+#include <time.h>
+
+#define NPIPES 4
+
+static int fds[NPIPES * 2][2];
+static int callcount;
+
+static void
+read_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    char c;
+
+    (void) ctx;
+    assert(read(verto_get_fd(ev), &c, 1) == 1);
+    callcount++;
+}
+
+static void
+add_readers(verto_ctx *ctx, int first)
+{
+    int i;
+
+    for (i = first; i < first + NPIPES; i++) {
+        assert(pipe(fds[i]) == 0);
+        assert(write(fds[i][1], "x", 1) == 1);
+        assert(verto_add_io(ctx, VERTO_EV_FLAG_IO_READ | VERTO_EV_FLAG_IO_CLOSE_FD,
+                            read_cb, fds[i][0]));
+    }
+}
+
+static void
+never_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+    (void) ev;
+}
+
+static void
+exit_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    int i;
+
+    (void) ev;
+    if (callcount != NPIPES * 2) {
+        printf("ERROR: Carried over events did not fire under verto_run()!\n");
+        retval = 1;
+    }
+
+    for (i = 0; i < NPIPES * 2; i++)
+        close(fds[i][1]);
+    verto_set_dispatch_budget(ctx, 0, 0);
+    verto_break(ctx);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    verto_ev *never;
+    time_t start;
+
+    callcount = 0;
+    add_readers(ctx, 0);
+
+    verto_set_dispatch_budget(ctx, 1, 0);
+    verto_run_nowait(ctx);
+    if (callcount != 1) {
+        printf("ERROR: Budget of 1 fired %d callbacks!\n", callcount);
+        return 1;
+    }
+
+    verto_run_nowait(ctx);
+    if (callcount != 2) {
+        printf("ERROR: Carried over event did not fire!\n");
+        return 1;
+    }
+
+    verto_set_dispatch_budget(ctx, 0, 0);
+    verto_run_nowait(ctx);
+    if (callcount != NPIPES) {
+        printf("ERROR: Unlimited budget fired %d of %d callbacks!\n",
+               callcount, NPIPES);
+        return 1;
+    }
+
+    /* Nothing is ready, verto_run_for() must return by itself */
+    never = verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, never_cb, 60000);
+    assert(never);
+    start = time(NULL);
+    verto_run_for(ctx, 100);
+    if (time(NULL) - start > 2) {
+        printf("ERROR: verto_run_for() did not time out!\n");
+        return 1;
+    }
+    verto_del(never);
+
+    add_readers(ctx, NPIPES);
+    verto_set_dispatch_budget(ctx, 1, 0);
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, exit_cb, 100));
+    return 0;
+}
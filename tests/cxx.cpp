@@ -0,0 +1,106 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdio>
+#include <string>
+
+#include <verto.hpp>
+
+#define check(cond) \
+    do { \
+        if (!(cond)) { \
+            std::printf("ERROR: %s (line %d)!\n", #cond, __LINE__); \
+            return 1; \
+        } \
+    } while (0)
+
+static int live;
+
+/* Counts its copies, to check that heap callables are destroyed */
+struct tracker {
+    tracker() { live++; }
+    tracker(const tracker &) { live++; }
+    ~tracker() { live--; }
+};
+
+int
+main()
+{
+    int ticks = 0, fired = 0;
+
+    {
+        /* nullptr picks the default implementation, as in verto_new() */
+        verto::context ctx(nullptr);
+        check(ctx);
+
+        /* A reference capture fits in the private pointer */
+        auto tick = [&ticks](verto::event ev) {
+            if (++ticks == 3)
+                ev.del();
+        };
+        static_assert(verto::detail::slot_for<decltype(tick)>::inplace,
+                      "reference capture should be stored in place");
+        check(ctx.add_timeout(VERTO_EV_FLAG_PERSIST, 1, tick));
+
+        /* These go to the heap and are destroyed with their event: the
+         * first after it fires, the second when the context is freed */
+        {
+            std::string name("heap");
+            tracker t;
+            verto_ctx *raw = ctx.get();
+            auto done = [&fired, name, t, raw](verto::event) {
+                fired = name == "heap";
+                verto_break(raw);
+            };
+            static_assert(!verto::detail::slot_for<decltype(done)>::inplace,
+                          "large capture should be moved to the heap");
+            check(ctx.add_timeout(VERTO_EV_FLAG_NONE, 50, done));
+            check(ctx.add_timeout(VERTO_EV_FLAG_PERSIST, 10000,
+                                  [t](verto::event) {}));
+        }
+        check(live == 2);
+
+        ctx.run();
+        check(ticks == 3 && fired == 1);
+        check(live == 1);
+
+        /* unique_event deletes its event */
+        {
+            verto::unique_event idle(ctx.add_idle(VERTO_EV_FLAG_PERSIST,
+                                                  [](verto::event) {}));
+            check(idle);
+        }
+    }
+    check(live == 0);
+
+    /* adopt() takes over a verto_ctx from the C API */
+    {
+        verto::context ctx = verto::context::adopt(verto_new(nullptr,
+                                                   VERTO_EV_TYPE_NONE));
+        verto::context moved(std::move(ctx));
+        check(!ctx && moved);
+    }
+
+    return 0;
+}
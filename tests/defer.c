@@ -0,0 +1,105 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "test.h"
+
+/* Enough to grow the ring buffer a few times, while it wraps around */
+#define CHAIN 100
+#define BATCH 40
+
+static int incallback;
+static int chained;
+static int order[2];
+static int ordered;
+
+static void
+exit_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    retval = 1;
+    if (ordered != 2 || order[0] != 1 || order[1] != 2)
+        printf("ERROR: Deferred functions did not run in order!\n");
+    else if (chained != CHAIN * BATCH)
+        printf("ERROR: %d of %d chained functions ran!\n",
+               chained, CHAIN * BATCH);
+    else
+        retval = 0;
+
+    verto_break(ctx);
+}
+
+static void
+second(verto_ctx *ctx, void *arg)
+{
+    (void) ctx;
+    (void) arg;
+    order[ordered++] = 2;
+}
+
+static void
+first(verto_ctx *ctx, void *arg)
+{
+    (void) arg;
+    if (incallback)
+        printf("ERROR: Deferred function ran inside the callback!\n");
+    order[ordered++] = 1;
+    assert(verto_defer(ctx, second, NULL));
+}
+
+static void
+chain(verto_ctx *ctx, void *arg)
+{
+    int left = (int) (long) arg;
+
+    chained++;
+    if (left > 0)
+        assert(verto_defer(ctx, chain, (void *) (long) (left - 1)));
+}
+
+static void
+cb(verto_ctx *ctx, verto_ev *ev)
+{
+    int i;
+
+    (void) ev;
+    incallback = 1;
+    assert(verto_defer(ctx, first, NULL));
+    if (ordered != 0)
+        printf("ERROR: Deferred function ran right away!\n");
+    incallback = 0;
+
+    for (i = 0; i < BATCH; i++)
+        assert(verto_defer(ctx, chain, (void *) (long) (CHAIN - 1)));
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    incallback = chained = ordered = 0;
+    assert(!verto_defer(ctx, NULL, NULL));
+
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, cb, 10));
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, exit_cb, 100));
+    return 0;
+}
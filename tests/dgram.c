@@ -0,0 +1,139 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "test.h"
+
+#define SENT 5
+#define REPLIES 3
+
+static int peer;
+static int received;
+static int truncated;
+
+static int
+udp_socket(struct sockaddr_in *addr)
+{
+    socklen_t len = sizeof(*addr);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    assert(fd >= 0);
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(bind(fd, (struct sockaddr *) addr, sizeof(*addr)) == 0);
+    assert(getsockname(fd, (struct sockaddr *) addr, &len) == 0);
+    assert(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0);
+    return fd;
+}
+
+static void
+dgram_cb(verto_dgram *dgram, const verto_datagram *msgs, size_t count,
+         int error)
+{
+    size_t i;
+    int j;
+
+    if (error) {
+        printf("ERROR: %s\n", strerror(error));
+        retval = 1;
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (msgs[i].truncated)
+            truncated++;
+        else if (msgs[i].len != 1
+                 || *(char *) msgs[i].data != '0' + received) {
+            printf("ERROR: Unexpected datagram!\n");
+            retval = 1;
+        }
+        received++;
+    }
+
+    /* Reply to the sender of the last one */
+    if (received == SENT) {
+        for (j = 0; j < REPLIES; j++) {
+            assert(verto_dgram_send(dgram, "reply", 5, msgs[count - 1].addr,
+                                    msgs[count - 1].addrlen));
+        }
+        assert(verto_dgram_get_pending(dgram) == REPLIES);
+    }
+}
+
+static void
+exit_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    char buf[16];
+    int replies = 0;
+
+    while (recv(peer, buf, sizeof(buf), 0) == 5)
+        replies++;
+
+    if (received != SENT || truncated != 1 || replies != REPLIES) {
+        printf("ERROR: %d received (%d truncated), %d replies!\n", received,
+               truncated, replies);
+        retval = 1;
+    }
+
+    close(peer);
+    verto_dgram_free(verto_get_private(ev));
+    verto_break(ctx);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    struct sockaddr_in addr, peeraddr;
+    verto_dgram *dgram;
+    verto_ev *ev;
+    char big[32];
+    int fd, i;
+
+    received = truncated = 0;
+
+    fd = udp_socket(&addr);
+    peer = udp_socket(&peeraddr);
+
+    /* Two wakeups at most, the last one too big for the ring */
+    dgram = passert(verto_dgram_new(ctx, VERTO_EV_FLAG_IO_CLOSE_FD, dgram_cb,
+                                    fd, 4, 16));
+    for (i = 0; i < SENT - 1; i++) {
+        big[0] = '0' + i;
+        assert(sendto(peer, big, 1, 0, (struct sockaddr *) &addr,
+                      sizeof(addr)) == 1);
+    }
+    memset(big, 'x', sizeof(big));
+    assert(sendto(peer, big, sizeof(big), 0, (struct sockaddr *) &addr,
+                  sizeof(addr)) == sizeof(big));
+
+    ev = passert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, exit_cb, 100));
+    verto_set_private(ev, dgram, NULL);
+    return 0;
+}
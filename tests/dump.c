@@ -0,0 +1,141 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "test.h"
+
+static int fds[2];
+static verto_ev *reader;
+static int ticks;
+
+static int
+count_cb(verto_ctx *ctx, verto_ev *ev, void *data)
+{
+    (void) ctx;
+    (void) ev;
+
+    ++*(size_t *) data;
+    return 1;
+}
+
+static int
+del_cb(verto_ctx *ctx, verto_ev *ev, void *data)
+{
+    (void) ctx;
+
+    if (ev == data)
+        verto_del(ev);
+    return 1;
+}
+
+static int
+dumped(verto_ctx *ctx, verto_dump_format format, const char *needle)
+{
+    char buf[4096];
+    FILE *file;
+    size_t len;
+
+    file = passert(tmpfile());
+    assert(verto_dump(ctx, file, format));
+    rewind(file);
+    len = fread(buf, 1, sizeof(buf) - 1, file);
+    buf[len] = '\0';
+    fclose(file);
+    return strstr(buf, needle) != NULL;
+}
+
+static void
+noop_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+    (void) ev;
+}
+
+static void
+tick_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    size_t count = 0;
+
+    /* Callbacks are only timed with introspection */
+    if (++ticks == 1) {
+        if (verto_get_time_since_fire(ev) != -1) {
+            printf("ERROR: Callback timed without introspection!\n");
+            retval = 1;
+        }
+        verto_set_introspection(ctx, 1);
+    }
+    if (ticks < 3)
+        return;
+
+    if (verto_get_fire_count(ev) != 3 || verto_get_time_since_fire(ev) < 0
+            || verto_get_fire_count(reader) != 0
+            || verto_get_time_since_fire(reader) != -1) {
+        printf("ERROR: Wrong fire count or time!\n");
+        retval = 1;
+    }
+
+    /* Only the events added here, not verto's own */
+    if (verto_foreach_event(ctx, count_cb, &count) != 2 || count != 2) {
+        printf("ERROR: Visited %u events instead of 2!\n", (unsigned) count);
+        retval = 1;
+    }
+
+    if (!dumped(ctx, VERTO_DUMP_JSON, "\"type\": \"io\"")
+            || !dumped(ctx, VERTO_DUMP_JSON, "\"fires\": 3, ")
+            || !dumped(ctx, VERTO_DUMP_JSON, "\"since_fire_ms\": null}")
+            || !dumped(ctx, VERTO_DUMP_TEXT, "flags=persist|io_read")
+            || !dumped(ctx, VERTO_DUMP_TEXT, "interval=5 fires=3")) {
+        printf("ERROR: Event missing from the dump!\n");
+        retval = 1;
+    }
+
+    /* The visitor may delete events */
+    verto_foreach_event(ctx, del_cb, reader);
+    count = 0;
+    verto_foreach_event(ctx, count_cb, &count);
+    if (count != 1 || dumped(ctx, VERTO_DUMP_TEXT, "io ")) {
+        printf("ERROR: Deleted event still visited!\n");
+        retval = 1;
+    }
+
+    verto_del(ev);
+    close(fds[0]);
+    close(fds[1]);
+    verto_break(ctx);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    ticks = 0;
+    assert(pipe(fds) == 0);
+    assert(dumped(ctx, VERTO_DUMP_JSON, "\"events\": []}"));
+
+    reader = passert(verto_add_io(ctx, VERTO_EV_FLAG_PERSIST
+                                       | VERTO_EV_FLAG_IO_READ,
+                                  noop_cb, fds[0]));
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_PERSIST, tick_cb, 5));
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "test.h"
+
+static int fds[2];
+static char trace[16];
+static int logged;
+
+static void
+exit_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    trace[logged] = '\0';
+    if (strcmp(trace, "rwyYsR")) {
+        printf("ERROR: Fibers ran as \"%s\" instead of \"rwyYsR\"!\n", trace);
+        retval = 1;
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    verto_break(ctx);
+}
+
+static void
+reader(void *arg)
+{
+    char c;
+
+    (void) arg;
+    trace[logged++] = 'r';
+    if (!(verto_wait_io(fds[0], VERTO_EV_FLAG_IO_READ) & VERTO_EV_FLAG_IO_READ))
+        return;
+    assert(read(fds[0], &c, 1) == 1);
+    trace[logged++] = 'R';
+}
+
+static void
+writer(void *arg)
+{
+    (void) arg;
+    trace[logged++] = 'w';
+    assert(verto_yield());
+    trace[logged++] = 'y';
+    assert(verto_yield());
+    trace[logged++] = 'Y';
+    assert(verto_sleep(10));
+    trace[logged++] = 's';
+    assert(write(fds[1], "x", 1) == 1);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    logged = 0;
+
+    /* Outside of a fiber, there is nothing to suspend */
+    assert(!verto_yield());
+    assert(!verto_sleep(0));
+
+    assert(pipe(fds) == 0);
+    if (!verto_spawn(ctx, reader, NULL, 0)) {
+        printf("WARNING: Fibers not supported!\n");
+        close(fds[0]);
+        close(fds[1]);
+        verto_break(ctx);
+        return 0;
+    }
+    assert(verto_spawn(ctx, writer, NULL, 64 * 1024));
+
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, exit_cb, 200));
+    return 0;
+}
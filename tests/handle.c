@@ -0,0 +1,115 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "test.h"
+
+static int fds[2];
+static verto_handle once;
+static verto_ev *reader;
+
+static void
+noop_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+    (void) ev;
+}
+
+static void
+once_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    /* Still valid within its callback */
+    if (verto_find_handle(ctx, once) != ev) {
+        printf("ERROR: Handle invalid within the callback!\n");
+        retval = 1;
+    }
+}
+
+static void
+exit_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    verto_ev *writer;
+    verto_handle handle;
+
+    /* Fired and freed */
+    if (verto_find_handle(ctx, once)) {
+        printf("ERROR: Handle still valid after the event was freed!\n");
+        retval = 1;
+    }
+
+    /* Looked up by fd, most recent first */
+    writer = passert(verto_add_io(ctx, VERTO_EV_FLAG_IO_WRITE, noop_cb,
+                                  fds[0]));
+    if (verto_find_io(ctx, fds[0]) != writer) {
+        printf("ERROR: Did not find the io event by fd!\n");
+        retval = 1;
+    }
+
+    /* The index follows verto_set_fd() and verto_del() */
+    handle = verto_get_handle(writer);
+    assert(verto_set_fd(writer, fds[1]));
+    if (verto_find_io(ctx, fds[0]) != reader
+            || verto_find_io(ctx, fds[1]) != writer) {
+        printf("ERROR: verto_set_fd() did not move the event!\n");
+        retval = 1;
+    }
+    verto_del(writer);
+    verto_del(reader);
+    if (verto_find_io(ctx, fds[0]) || verto_find_io(ctx, fds[1])
+            || verto_find_handle(ctx, handle)) {
+        printf("ERROR: Deleted events still found!\n");
+        retval = 1;
+    }
+
+    /* Slots are reused, but not handles */
+    ev = passert(verto_add_idle(ctx, VERTO_EV_FLAG_PERSIST, noop_cb));
+    if (verto_find_handle(ctx, handle)
+            || verto_find_handle(ctx, verto_get_handle(NULL))) {
+        printf("ERROR: Invalid handle matched!\n");
+        retval = 1;
+    }
+    verto_del(ev);
+
+    close(fds[0]);
+    close(fds[1]);
+    verto_break(ctx);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    verto_ev *ev;
+
+    assert(pipe(fds) == 0);
+    assert(!verto_find_io(ctx, fds[0]));
+
+    reader = passert(verto_add_io(ctx, VERTO_EV_FLAG_PERSIST
+                                       | VERTO_EV_FLAG_IO_READ,
+                                  noop_cb, fds[0]));
+    ev = passert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, once_cb, 10));
+    once = verto_get_handle(ev);
+    assert(verto_find_handle(ctx, once) == ev);
+    assert(verto_find_io(ctx, fds[0]) == reader);
+
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, exit_cb, 50));
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "test.h"
+
+static struct sockaddr_in addr;
+static struct rlimit limit;
+static int accepted;
+static int dropped = -1;
+
+static int
+client(void)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    assert(fd >= 0);
+    assert(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    return fd;
+}
+
+static void
+check_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    char c;
+    ssize_t bytes;
+
+    (void) ev;
+
+    assert(setrlimit(RLIMIT_NOFILE, &limit) == 0);
+
+    /* Accepted and closed for lack of descriptors */
+    assert(fcntl(dropped, F_SETFL, O_NONBLOCK) == 0);
+    bytes = read(dropped, &c, 1);
+    if (bytes != 0 && !(bytes < 0 && errno == ECONNRESET)) {
+        printf("ERROR: Connection not dropped on EMFILE!\n");
+        retval = 1;
+    }
+    if (accepted != 3) {
+        printf("ERROR: %d connections accepted instead of 3!\n", accepted);
+        retval = 1;
+    }
+
+    close(dropped);
+    verto_break(ctx);
+}
+
+static void
+accept_cb(verto_ctx *ctx, verto_ev *ev, int fd)
+{
+    struct rlimit none;
+    int next;
+
+    (void) ev;
+
+    if (fd < 0 || !(fcntl(fd, F_GETFL) & O_NONBLOCK)
+            || !(fcntl(fd, F_GETFD) & FD_CLOEXEC)) {
+        printf("ERROR: Bad accepted socket!\n");
+        retval = 1;
+        verto_break(ctx);
+        return;
+    }
+    close(fd);
+
+    if (++accepted < 3)
+        return;
+
+    /* Run out of descriptors with a connection pending */
+    dropped = client();
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, check_cb, 100));
+    next = dup(0);
+    assert(next >= 0);
+    close(next);
+    assert(getrlimit(RLIMIT_NOFILE, &limit) == 0);
+    none = limit;
+    none.rlim_cur = next;
+    assert(setrlimit(RLIMIT_NOFILE, &none) == 0);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    socklen_t len = sizeof(addr);
+    int fd, i;
+
+    accepted = 0;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(getsockname(fd, (struct sockaddr *) &addr, &len) == 0);
+    assert(listen(fd, 16) == 0);
+    assert(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0);
+
+    assert(verto_add_listener(ctx, fd, VERTO_EV_FLAG_IO_CLOSE_FD, accept_cb,
+                              2));
+
+    /* Two wakeups for three connections */
+    for (i = 0; i < 3; i++)
+        close(client());
+    return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/socket.h>
+
+#include "test.h"
+
+static int fds[2];
+static int readers;
+static verto_ev *timeout;
+
+static void
+writer_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+
+    if (verto_get_fd_state(ev) != VERTO_EV_FLAG_IO_WRITE) {
+        printf("ERROR: Writer fired with a state it didn't ask for!\n");
+        retval = 1;
+    }
+
+    /* The readers keep watching the fd without us */
+    verto_del(ev);
+    assert(write(fds[1], "x", 1) == 1);
+}
+
+static void
+reader_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    if (verto_get_fd_state(ev) != VERTO_EV_FLAG_IO_READ) {
+        printf("ERROR: Reader fired with a state it didn't ask for!\n");
+        retval = 1;
+    }
+
+    verto_del(ev);
+    if (++readers == 2) {
+        verto_del(timeout);
+        close(fds[0]);
+        close(fds[1]);
+        verto_break(ctx);
+    }
+}
+
+static void
+timeout_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+
+    printf("ERROR: Timeout!\n");
+    close(fds[0]);
+    close(fds[1]);
+    retval = 1;
+    verto_break(ctx);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    verto_ev *ev;
+
+    readers = 0;
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    /* Three events on the same fd */
+    assert(verto_add_io(ctx, VERTO_EV_FLAG_PERSIST | VERTO_EV_FLAG_IO_READ,
+                        reader_cb, fds[0]));
+    ev = passert(verto_add_io(ctx, VERTO_EV_FLAG_PERSIST
+                                   | VERTO_EV_FLAG_IO_READ,
+                              reader_cb, fds[1]));
+    assert(verto_add_io(ctx, VERTO_EV_FLAG_PERSIST | VERTO_EV_FLAG_IO_WRITE,
+                        writer_cb, fds[0]));
+
+    /* Moving an event onto the fd joins the others */
+    assert(verto_set_fd(ev, fds[0]));
+    assert(verto_find_io(ctx, fds[0]) == ev);
+
+    timeout = passert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE,
+                                        timeout_cb, 1000));
+    return 0;
+}
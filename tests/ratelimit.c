@@ -0,0 +1,91 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "test.h"
+
+static int fds[2];
+static int reads;
+static int suspended;
+
+static void
+read_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+
+    /* Never drained, so always readable */
+    if (verto_get_fd_state(ev) & VERTO_EV_FLAG_IO_READ)
+        reads++;
+}
+
+static void
+check_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    verto_ev *reader = verto_get_private(ev);
+
+    (void) ctx;
+
+    if (!(verto_get_flags(reader) & VERTO_EV_FLAG_IO_READ))
+        suspended++;
+}
+
+static void
+exit_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+
+    /* 3 in a row, then 20 per second */
+    if (reads < 5 || reads > 12) {
+        printf("ERROR: %d reads in 300ms!\n", reads);
+        retval = 1;
+    }
+    if (suspended == 0) {
+        printf("ERROR: Read interest never suspended!\n");
+        retval = 1;
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    verto_break(ctx);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    verto_ev *reader, *ev;
+
+    reads = suspended = 0;
+    assert(pipe(fds) == 0);
+    assert(write(fds[1], "x", 1) == 1);
+
+    reader = passert(verto_add_io(ctx, VERTO_EV_FLAG_PERSIST
+                                       | VERTO_EV_FLAG_IO_READ,
+                                  read_cb, fds[0]));
+    assert(verto_set_io_rate(reader, 20, 3));
+    assert(!verto_set_io_rate(NULL, 20, 3));
+
+    ev = passert(verto_add_timeout(ctx, VERTO_EV_FLAG_PERSIST, check_cb, 7));
+    verto_set_private(ev, reader, NULL);
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, exit_cb, 300));
+    return 0;
+}
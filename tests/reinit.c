@@ -0,0 +1,122 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "test.h"
+
+#define EVENTS 1000
+
+static int pipes[2];
+static int fired;
+
+static void
+noop_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+    (void) ev;
+}
+
+static void
+read_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    char c;
+
+    (void) ev;
+    if (read(pipes[0], &c, 1) == 1)
+        fired++;
+    verto_break(ctx);
+}
+
+static void
+late_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    fired += 100;
+    verto_break(ctx);
+}
+
+/* In the child: only the REINITIABLE events survive, and they still fire */
+static int
+child(verto_ctx *tmp)
+{
+    if (!verto_reinitialize(tmp)) {
+        printf("ERROR: Could not reinitialize the context!\n");
+        return 1;
+    }
+
+    if (write(pipes[1], "x", 1) != 1)
+        return 1;
+    verto_run(tmp);
+
+    if (fired != 1) {
+        printf("ERROR: Wrong events fired after fork (%d)!\n", fired);
+        return 1;
+    }
+    return 0;
+}
+
+static void
+exit_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    verto_break(ctx);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    verto_ctx *tmp;
+    int i, status;
+    pid_t pid;
+
+    fired = 0;
+    tmp = passert(verto_new(NULL, VERTO_EV_TYPE_NONE));
+    assert(pipe(pipes) == 0);
+
+    assert(verto_add_io(tmp, VERTO_EV_FLAG_PERSIST | VERTO_EV_FLAG_REINITIABLE
+                             | VERTO_EV_FLAG_IO_READ, read_cb, pipes[0]));
+    for (i = 0; i < EVENTS; i++) {
+        passert(verto_add_timeout(tmp, VERTO_EV_FLAG_PERSIST
+                                       | VERTO_EV_FLAG_REINITIABLE,
+                                  noop_cb, 10000 + i));
+        passert(verto_add_timeout(tmp, VERTO_EV_FLAG_NONE, late_cb, 0));
+    }
+
+    pid = fork();
+    assert(pid >= 0);
+    if (pid == 0)
+        _exit(child(tmp));
+
+    assert(waitpid(pid, &status, 0) == pid);
+    verto_free(tmp);
+    close(pipes[0]);
+    close(pipes[1]);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return 1;
+
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, exit_cb, 0));
+    return 0;
+}
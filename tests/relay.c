@@ -0,0 +1,167 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+
+#include "test.h"
+
+#define FILELEN (256 * 1024)
+#define PIPELEN 32000
+#define PIPECOUNT 16000
+
+typedef struct {
+    int fds[2];
+    int infd;
+    FILE *file;
+    size_t expected;
+    size_t received;
+} sink;
+
+static verto_ctx *context;
+static sink sinks[2];
+static int finished;
+
+static char
+pattern(size_t i)
+{
+    return (char) (i * 7 % 251);
+}
+
+static void
+timeout_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+
+    printf("ERROR: Timeout!\n");
+    retval = 1;
+    verto_break(ctx);
+}
+
+/* Both relays and both readers have to finish */
+static void
+check_done(void)
+{
+    if (++finished == 4)
+        verto_break(context);
+}
+
+static void
+relay_cb(verto_relay *relay, int error)
+{
+    sink *s = verto_relay_get_private(relay);
+
+    assert(error == 0);
+    assert(verto_relay_get_transferred(relay) == s->expected);
+    verto_relay_free(relay);
+
+    close(s->fds[1]);
+    if (s->file)
+        fclose(s->file);
+    else
+        close(s->infd);
+    check_done();
+}
+
+static void
+read_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    sink *s = verto_get_private(ev);
+    char buff[8192];
+    ssize_t i, bytes;
+
+    (void) ctx;
+
+    bytes = read(verto_get_fd(ev), buff, sizeof(buff));
+    assert(bytes > 0);
+    for (i = 0; i < bytes; i++)
+        assert(buff[i] == pattern(s->received + i));
+    s->received += bytes;
+    assert(s->received <= s->expected);
+
+    if (s->received == s->expected) {
+        verto_del(ev);
+        check_done();
+    }
+}
+
+static void
+add_sink(verto_ctx *ctx, sink *s, size_t expected)
+{
+    verto_ev *ev;
+
+    memset(s, 0, sizeof(sink));
+    s->expected = expected;
+    assert(pipe(s->fds) == 0);
+    assert(fcntl(s->fds[1], F_SETFL, O_NONBLOCK) == 0);
+
+    ev = verto_add_io(ctx, VERTO_EV_FLAG_PERSIST | VERTO_EV_FLAG_IO_READ
+                           | VERTO_EV_FLAG_IO_CLOSE_FD, read_cb, s->fds[0]);
+    assert(ev);
+    verto_set_private(ev, s, NULL);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    verto_relay *relay;
+    char buff[FILELEN];
+    FILE *file;
+    int fds[2];
+    size_t i;
+
+    context = ctx;
+    finished = 0;
+    for (i = 0; i < sizeof(buff); i++)
+        buff[i] = pattern(i);
+
+    /* A regular file, larger than the pipe, into a pipe (sendfile) */
+    assert((file = tmpfile()));
+    assert(fwrite(buff, 1, FILELEN, file) == FILELEN);
+    assert(fflush(file) == 0);
+    assert(lseek(fileno(file), 0, SEEK_SET) == 0);
+
+    add_sink(ctx, &sinks[0], FILELEN);
+    relay = verto_relay_new(ctx, VERTO_EV_FLAG_NONE, relay_cb,
+                            fileno(file), sinks[0].fds[1], 0);
+    assert(relay);
+    verto_relay_set_private(relay, &sinks[0]);
+    sinks[0].file = file;
+
+    /* Part of a pipe into another pipe (splice) */
+    assert(pipe(fds) == 0);
+    assert(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+    assert(write(fds[1], buff, PIPELEN) == PIPELEN);
+
+    add_sink(ctx, &sinks[1], PIPECOUNT);
+    relay = verto_relay_new(ctx, VERTO_EV_FLAG_NONE, relay_cb,
+                            fds[0], sinks[1].fds[1], PIPECOUNT);
+    assert(relay);
+    verto_relay_set_private(relay, &sinks[1]);
+    sinks[1].infd = fds[0];
+    close(fds[1]);
+
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, timeout_cb, 1000));
+    return 0;
+}
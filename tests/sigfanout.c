@@ -0,0 +1,104 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <signal.h>
+
+#include "test.h"
+
+static verto_ctx *other;
+static verto_ev *timeout;
+static int counts[2];
+
+static void
+finish(verto_ctx *ctx)
+{
+    if (counts[0] != 1)
+        printf("ERROR: Signal did not reach the first context!\n");
+    if (counts[1] != 1)
+        printf("ERROR: Signal did not reach the second context!\n");
+    retval = retval || counts[0] != 1 || counts[1] != 1;
+
+    verto_free(other);
+    verto_break(ctx);
+}
+
+static void
+cb(verto_ctx *ctx, verto_ev *ev)
+{
+    if (verto_get_signal_count(ev) < 1) {
+        printf("ERROR: Signal count is %u!\n", verto_get_signal_count(ev));
+        retval = 1;
+    }
+
+    if (ctx == other) {
+        counts[1]++;
+        return;
+    }
+
+    counts[0]++;
+    verto_del(timeout);
+    finish(ctx);
+}
+
+static void
+other_exit_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    verto_break(ctx);
+}
+
+static void
+exit_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    finish(ctx);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    counts[0] = counts[1] = 0;
+
+    /* A second context, of any implementation, must see the signal too */
+    other = verto_new(NULL, VERTO_EV_TYPE_SIGNAL);
+    if (!other || !(verto_get_supported_types(ctx) & VERTO_EV_TYPE_SIGNAL)) {
+        printf("WARNING: Signal not supported!\n");
+        verto_free(other);
+        verto_break(ctx);
+        return 0;
+    }
+
+    assert(verto_add_signal(ctx, VERTO_EV_FLAG_PERSIST, cb, SIGUSR1));
+    assert(verto_add_signal(other, VERTO_EV_FLAG_PERSIST, cb, SIGUSR1));
+
+    assert(kill(getpid(), SIGUSR1) == 0);
+
+    /* Let the second context read the signalfd first */
+    assert(verto_add_timeout(other, VERTO_EV_FLAG_NONE, other_exit_cb, 100));
+    verto_run(other);
+
+    timeout = verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, exit_cb, 1000);
+    assert(timeout);
+    return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "test.h"
+
+static int count;
+
+static void
+signal_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    count++;
+    verto_break(ctx);
+}
+
+static void
+timeout_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    verto_break(ctx);
+}
+
+/* Waits up to a second for the signal */
+static int
+caught(verto_ctx *ctx)
+{
+    verto_ev *timeout;
+
+    count = 0;
+    assert(kill(getpid(), SIGUSR1) == 0);
+    timeout = passert(verto_add_timeout(ctx, VERTO_EV_FLAG_PERSIST,
+                                        timeout_cb, 1000));
+    verto_run(ctx);
+    verto_del(timeout);
+    return count == 1;
+}
+
+/* The child reinitializes the context and catches the signal, then stops
+ * watching it: none of this may reach the parent's signal handling */
+static int
+child(verto_ctx *tmp)
+{
+    if (!verto_reinitialize(tmp)) {
+        printf("ERROR: Could not reinitialize the context!\n");
+        return 1;
+    }
+
+    if (!caught(tmp)) {
+        printf("ERROR: Signal not caught after fork!\n");
+        return 1;
+    }
+
+    verto_free(tmp);
+    return 0;
+}
+
+static void
+exit_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    verto_break(ctx);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    verto_ctx *tmp;
+    int status;
+    pid_t pid;
+
+    tmp = verto_new(NULL, VERTO_EV_TYPE_SIGNAL);
+    if (!tmp || !(verto_get_supported_types(tmp) & VERTO_EV_TYPE_SIGNAL)) {
+        printf("WARNING: Signal not supported!\n");
+        verto_free(tmp);
+        verto_break(ctx);
+        return 0;
+    }
+
+    assert(verto_add_signal(tmp, VERTO_EV_FLAG_PERSIST
+                                 | VERTO_EV_FLAG_REINITIABLE,
+                            signal_cb, SIGUSR1));
+
+    pid = fork();
+    assert(pid >= 0);
+    if (pid == 0)
+        _exit(child(tmp));
+
+    assert(waitpid(pid, &status, 0) == pid);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        verto_free(tmp);
+        return 1;
+    }
+
+    if (!caught(tmp)) {
+        printf("ERROR: The child broke the parent's signal handling!\n");
+        verto_free(tmp);
+        return 1;
+    }
+
+    verto_free(tmp);
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, exit_cb, 0));
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <signal.h>
+
+#include "test.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+
+static pthread_mutex_t started = PTHREAD_MUTEX_INITIALIZER;
+static verto_ev *timeout;
+static int counts[2];
+
+static void
+thread_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    counts[1]++;
+    verto_break(ctx);
+}
+
+static void *
+thread_main(void *arg)
+{
+    verto_ctx *ctx;
+
+    (void) arg;
+
+    /* This thread started before the main thread watched the signal, so it
+     * did not inherit a mask blocking it.  Watching the signal here must
+     * block it in this thread too, or the kill() below may be delivered to
+     * this thread and terminate the process. */
+    pthread_mutex_lock(&started);
+    pthread_mutex_unlock(&started);
+
+    ctx = verto_new(NULL, VERTO_EV_TYPE_SIGNAL);
+    if (!ctx)
+        return NULL;
+
+    if (verto_add_signal(ctx, VERTO_EV_FLAG_PERSIST, thread_cb, SIGUSR1)
+            && verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, thread_cb, 1000)
+            && kill(getpid(), SIGUSR1) == 0)
+        verto_run(ctx);
+
+    verto_free(ctx);
+    return NULL;
+}
+
+static void
+finish(verto_ctx *ctx)
+{
+    if (counts[0] != 1)
+        printf("ERROR: Signal did not reach the main thread!\n");
+    if (counts[1] != 1)
+        printf("ERROR: Signal did not reach the second thread!\n");
+    retval = retval || counts[0] != 1 || counts[1] != 1;
+    verto_break(ctx);
+}
+
+static void
+cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    counts[0]++;
+    verto_del(timeout);
+    finish(ctx);
+}
+
+static void
+exit_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    finish(ctx);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    pthread_t thread;
+    verto_ctx *probe;
+
+    counts[0] = counts[1] = 0;
+
+    probe = verto_new(NULL, VERTO_EV_TYPE_SIGNAL);
+    if (!probe || !(verto_get_supported_types(ctx) & VERTO_EV_TYPE_SIGNAL)) {
+        printf("WARNING: Signal not supported!\n");
+        verto_free(probe);
+        verto_break(ctx);
+        return 0;
+    }
+    verto_free(probe);
+
+    pthread_mutex_lock(&started);
+    assert(pthread_create(&thread, NULL, thread_main, NULL) == 0);
+    assert(verto_add_signal(ctx, VERTO_EV_FLAG_PERSIST, cb, SIGUSR1));
+    pthread_mutex_unlock(&started);
+    assert(pthread_join(thread, NULL) == 0);
+
+    timeout = verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, exit_cb, 1000);
+    assert(timeout);
+    return 0;
+}
+#else
+int
+do_test(verto_ctx *ctx)
+{
+    printf("WARNING: Threads not supported!\n");
+    verto_break(ctx);
+    return 0;
+}
+#endif
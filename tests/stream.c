@@ -0,0 +1,125 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "test.h"
+
+#define DATA "hello world"
+#define DATALEN 11
+
+static verto_stream *streams[2];
+static int released;
+
+static void
+timeout_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+
+    printf("ERROR: Timeout!\n");
+    verto_stream_free(streams[0]);
+    verto_stream_free(streams[1]);
+    retval = 1;
+    verto_break(ctx);
+}
+
+static void
+release_cb(void *data)
+{
+    assert(!strcmp(data, "world"));
+    released++;
+}
+
+/* The writing side only sees EOF, once the other side is freed */
+static void
+writer_cb(verto_stream *stream, int error)
+{
+    assert(error == 0);
+    assert(verto_stream_is_eof(stream));
+    assert(verto_stream_get_readable(stream) == 0);
+
+    verto_break(verto_get_ctx(verto_stream_get_ev(stream)));
+    verto_stream_free(stream);
+    streams[0] = NULL;
+}
+
+static void
+reader_cb(verto_stream *stream, int error)
+{
+    char buff[DATALEN];
+    struct iovec iov[4];
+    size_t total = 0;
+    int i, n;
+
+    assert(error == 0);
+    if (verto_stream_get_readable(stream) < DATALEN)
+        return;
+
+    n = verto_stream_peek(stream, iov, 4);
+    for (i = 0; i < n; i++)
+        total += iov[i].iov_len;
+    assert(total == DATALEN);
+    assert(verto_stream_read(stream, buff, DATALEN) == DATALEN);
+    assert(!memcmp(buff, DATA, DATALEN));
+    assert(verto_stream_get_readable(stream) == 0);
+
+    /* Everything was flushed, so write interest must be off again */
+    assert(released == 1);
+    assert(verto_stream_get_pending(streams[0]) == 0);
+    assert(!(verto_get_flags(verto_stream_get_ev(streams[0]))
+             & VERTO_EV_FLAG_IO_WRITE));
+
+    verto_stream_free(stream); /* Closes the fd, so the writer gets EOF */
+    streams[1] = NULL;
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    int fds[2];
+
+    released = 0;
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    assert(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+    assert(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+
+    streams[0] = verto_stream_new(ctx, VERTO_EV_FLAG_IO_CLOSE_FD,
+                                  writer_cb, fds[0]);
+    streams[1] = verto_stream_new(ctx, VERTO_EV_FLAG_IO_CLOSE_FD,
+                                  reader_cb, fds[1]);
+    assert(streams[0] && streams[1]);
+    assert(!(verto_get_flags(verto_stream_get_ev(streams[0]))
+             & VERTO_EV_FLAG_IO_WRITE));
+
+    assert(verto_stream_write(streams[0], "hello ", 6));
+    assert(verto_get_flags(verto_stream_get_ev(streams[0]))
+           & VERTO_EV_FLAG_IO_WRITE);
+    assert(verto_stream_write_ref(streams[0], "world", 5, release_cb));
+    assert(verto_stream_get_pending(streams[0]) == DATALEN);
+
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, timeout_cb, 1000));
+    return 0;
+}
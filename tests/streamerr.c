@@ -0,0 +1,92 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "test.h"
+
+static verto_stream *stream;
+static int errors;
+static int released;
+
+static void
+release_cb(void *data)
+{
+    (void) data;
+    released++;
+}
+
+static void
+stream_cb(verto_stream *s, int error)
+{
+    (void) s;
+    if (error)
+        errors++;
+}
+
+/* Lets the loop spin for a while: the error must not come back */
+static void
+exit_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+
+    if (errors != 1) {
+        printf("ERROR: Write error reported %d times!\n", errors);
+        retval = 1;
+    }
+    if (released != 1 || verto_stream_get_pending(stream) != 0) {
+        printf("ERROR: Output not dropped after the error!\n");
+        retval = 1;
+    }
+    if (verto_stream_write(stream, "again", 5)) {
+        printf("ERROR: Write accepted after the error!\n");
+        retval = 1;
+    }
+
+    verto_stream_free(stream);
+    verto_break(ctx);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    int fds[2];
+
+    errors = released = 0;
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Writing to a closed peer fails with EPIPE */
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    assert(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+    close(fds[1]);
+
+    stream = passert(verto_stream_new(ctx, VERTO_EV_FLAG_IO_CLOSE_FD,
+                                      stream_cb, fds[0]));
+    assert(verto_stream_write(stream, "hello ", 6));
+    assert(verto_stream_write_ref(stream, "world", 5, release_cb));
+
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, exit_cb, 100));
+    return 0;
+}
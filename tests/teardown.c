@@ -0,0 +1,122 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "test.h"
+
+#define EVENTS 20000
+
+static int freed;
+static int pipes[2];
+
+static void
+noop_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+    (void) ev;
+}
+
+static void
+count_onfree(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+    (void) ev;
+    freed++;
+}
+
+/* Deletes another event, which is being freed too */
+static void
+del_onfree(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+    freed++;
+    verto_del(verto_get_private(ev));
+}
+
+/* Adds an event while the context is being freed */
+static void
+add_onfree(verto_ctx *ctx, verto_ev *ev)
+{
+    verto_ev *tmp;
+
+    (void) ev;
+    freed++;
+    tmp = verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, noop_cb, 1000);
+    if (tmp)
+        verto_set_private(tmp, NULL, count_onfree);
+}
+
+static void
+exit_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    verto_break(ctx);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    verto_ctx *tmp;
+    verto_ev *ev, *prev = NULL;
+    int i;
+
+    freed = 0;
+    tmp = passert(verto_new(NULL, VERTO_EV_TYPE_NONE));
+    assert(pipe(pipes) == 0);
+
+    for (i = 0; i < EVENTS; i++) {
+        if (i % 2)
+            ev = verto_add_timeout(tmp, VERTO_EV_FLAG_PERSIST, noop_cb,
+                                   1000 + i);
+        else
+            ev = verto_add_io(tmp, VERTO_EV_FLAG_PERSIST
+                                   | VERTO_EV_FLAG_IO_READ, noop_cb, pipes[0]);
+        passert(ev);
+
+        if (i % 100 == 1 && prev)
+            verto_set_private(ev, prev, del_onfree);
+        else
+            verto_set_private(ev, NULL, count_onfree);
+        prev = ev;
+    }
+
+    /* Deleting events from the middle of the list */
+    for (i = 0; i < 10; i++)
+        verto_del(passert(verto_add_timeout(tmp, VERTO_EV_FLAG_NONE,
+                                            noop_cb, 1000)));
+    verto_set_private(passert(verto_add_idle(tmp, VERTO_EV_FLAG_PERSIST,
+                                             noop_cb)),
+                      NULL, add_onfree);
+
+    verto_free(tmp);
+    close(pipes[0]);
+    close(pipes[1]);
+
+    /* Every onfree ran once, including for the event added by one */
+    if (freed != EVENTS + 2) {
+        printf("ERROR: %d of %d onfree callbacks ran!\n", freed, EVENTS + 2);
+        return 1;
+    }
+
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, exit_cb, 0));
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "test.h"
+
+#define ROUNDS 10
+
+static int persistcount;
+static int oncecount;
+static int freed;
+
+static void
+exit_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ev;
+    retval = 1;
+    if (oncecount != 1)
+        printf("ERROR: Triggered event fired %d times!\n", oncecount);
+    else if (!freed)
+        printf("ERROR: Non-persistent user event was not freed!\n");
+    else if (persistcount != ROUNDS)
+        printf("ERROR: Persistent user event fired %d times!\n", persistcount);
+    else
+        retval = 0;
+
+    verto_break(ctx);
+}
+
+static void
+onfree(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+    (void) ev;
+    freed = 1;
+}
+
+static void
+once_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+    (void) ev;
+    oncecount++;
+}
+
+static void
+persist_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+
+    /* Re-triggering from the callback must not fire again right away */
+    if (++persistcount < ROUNDS) {
+        verto_trigger(ev);
+        verto_trigger(ev);
+    }
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    verto_ev *ev;
+
+    persistcount = oncecount = freed = 0;
+
+    if (!(verto_get_supported_types(ctx) & VERTO_EV_TYPE_USER)) {
+        printf("ERROR: User events not supported!\n");
+        return 1;
+    }
+
+    ev = verto_add_user(ctx, VERTO_EV_FLAG_NONE, once_cb);
+    assert(ev);
+    verto_set_private(ev, NULL, onfree);
+    verto_trigger(ev);
+    verto_trigger(ev);
+
+    ev = verto_add_user(ctx, VERTO_EV_FLAG_PERSIST, persist_cb);
+    assert(ev);
+    verto_trigger(ev);
+
+    /* Each iteration fires what was triggered before it started */
+    verto_run_nowait(ctx);
+    if (oncecount != 1 || persistcount != 1) {
+        printf("ERROR: Triggered events did not fire in the next iteration!\n");
+        return 1;
+    }
+
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, exit_cb, 100));
+    return 0;
+}
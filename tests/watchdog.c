@@ -0,0 +1,91 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "test.h"
+
+static verto_callback *stalled;
+static size_t depth;
+
+static void
+stall_cb(verto_ctx *ctx, const verto_stall *stall, void *data)
+{
+    (void) ctx;
+
+    assert(data == &depth);
+    depth = stall->depth;
+    stalled = stall->ncallbacks > 0 ? stall->callbacks[0] : NULL;
+}
+
+static void
+block_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    (void) ctx;
+    (void) ev;
+
+    usleep(100000);
+}
+
+static void
+check_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    verto_stats stats;
+
+    (void) ev;
+
+    /* Stopping the watchdog waits for its report to be done */
+    assert(verto_set_watchdog(ctx, 0, NULL, NULL));
+    assert(verto_get_stats(ctx, &stats));
+
+    if (stalled != block_cb || depth != 1) {
+        printf("ERROR: The blocking callback was not reported!\n");
+        retval = 1;
+    }
+    if (stats.stalls != 1 || stats.longest_stall_usec < 90000) {
+        printf("ERROR: Stall not counted (%lu, %lu us)!\n", stats.stalls,
+               stats.longest_stall_usec);
+        retval = 1;
+    }
+    verto_break(ctx);
+}
+
+int
+do_test(verto_ctx *ctx)
+{
+    verto_stats stats;
+
+    stalled = NULL;
+    depth = 0;
+
+    assert(verto_get_stats(ctx, &stats));
+    assert(stats.stalls == 0 && stats.longest_stall_usec == 0);
+
+    if (!verto_set_watchdog(ctx, 20000, stall_cb, &depth)) {
+        printf("WARNING: Threads not supported!\n");
+        verto_break(ctx);
+        return 0;
+    }
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, block_cb, 10));
+    assert(verto_add_timeout(ctx, VERTO_EV_FLAG_NONE, check_cb, 150));
+    return 0;
+}